@@ -0,0 +1,159 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+
+# Decoder micro-benchmarks.
+#
+# Usage: python3 bench_chjson.py [-n SECONDS] [--strict] [CASE ...]
+#
+# Each case builds a document once and then times chjson.decode (and, where
+# the document is valid JSON, the stdlib json.loads for comparison), and
+# reports the best throughput over a few repeats.
+
+import argparse
+import json
+import sys
+import timeit
+
+import chjson
+
+def _records(n):
+    return [
+        {
+            "id": i,
+            "name": "record %d" % (i,),
+            "active": (i % 3) == 0,
+            "score": i * 0.25,
+            "tags": ["alpha", "beta", "gamma"],
+            "parent": None,
+        }
+        for i in range(n)
+    ]
+
+def case_indented():
+    return json.dumps(_records(5000), indent=4)
+
+def case_indented_tabs():
+    return json.dumps(_records(5000), indent="\t")
+
+def case_deep_indent():
+    doc = {"value": 1}
+    for i in range(12):
+        doc = {"level%d" % (i,): [doc, doc], "flag": True}
+    return json.dumps(doc, indent=8)
+
+def case_strings():
+    template = "<div class=\"row\">{{ name }}</div>\n" * 40
+    blob = "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2" * 64
+    return json.dumps([{"template": template, "blob": blob} for _ in range(200)])
+
+def case_wide_strings():
+    # Non-ASCII str input, which is parsed in place as UCS-2.
+    text = "東京都の天気は晴れ、最高気温は二十五度です。" * 20
+    return json.dumps([{"title": "記事 %d" % (i,), "body": text} for i in range(2000)],
+                      ensure_ascii=False)
+
+def case_utf8_bytes():
+    # The same, as it would arrive off the network: UTF-8 bytes.
+    return case_wide_strings().encode("utf-8")
+
+def case_integers():
+    # Telemetry-style arrays of counters and timestamps.
+    rows = [[1500000000 + i, i % 97, -(i * 31 % 1000), i * 1000003] for i in range(50000)]
+    return json.dumps(rows)
+
+def case_floats():
+    # Geo coordinates and metrics.
+    rows = [
+        {"lat": round(37.0 + (i % 1000) / 1311.0, 6),
+         "lng": round(-122.0 - (i % 997) / 1733.0, 6),
+         "value": round(i * 0.001, 3), "ratio": 1.0 / (i + 1)}
+        for i in range(20000)
+    ]
+    return json.dumps(rows)
+
+def case_records():
+    # Wide rows, all with the same keys in the same order.
+    fields = ["field_%02d" % (j,) for j in range(12)]
+    return json.dumps([dict((field, i + j) for j, field in enumerate(fields)) for i in range(20000)])
+
+def case_comments():
+    # A hand-maintained config: a license header, documented settings and
+    # commented-out blocks, which strict JSON doesn't allow.
+    header = "/*\n" + "".join(
+        " * This file is part of the example configuration, line %d.\n" % (i,)
+        for i in range(40)
+    ) + " */\n"
+    sections = []
+    for i in range(500):
+        sections.append(
+            "  // Section %d: what each of these does, and why it's set the way\n"
+            "  // it is. Change with care; see the docs for the other options.\n"
+            "  \"section_%d\": {\n"
+            "    \"enabled\": true, // Turn this off to skip the section.\n"
+            "    \"retries\": %d, /* Before giving up. */\n"
+            "    /* \"legacy\": {\n"
+            "      \"mode\": \"compat\",\n"
+            "    }, */\n"
+            "    \"name\": \"section %d\",\n"
+            "  },\n" % (i, i, i % 5, i)
+        )
+    return header + "{\n" + "".join(sections) + "}\n"
+
+def case_minified():
+    return json.dumps(_records(5000), separators=(",", ":"))
+
+CASES = [
+    ("indented", case_indented, True),
+    ("indented_tabs", case_indented_tabs, True),
+    ("deep_indent", case_deep_indent, True),
+    ("minified", case_minified, True),
+    ("strings", case_strings, True),
+    ("wide_strings", case_wide_strings, True),
+    ("utf8_bytes", case_utf8_bytes, True),
+    ("integers", case_integers, True),
+    ("floats", case_floats, True),
+    ("records", case_records, True),
+    ("comments", case_comments, False),
+]
+
+def _best(fcn, seconds):
+    number = 1
+    while True:
+        elapsed = timeit.timeit(fcn, number=number)
+        if elapsed >= 0.2:
+            break
+        number *= 2
+    repeat = max(3, int(seconds / elapsed))
+    return min(timeit.repeat(fcn, number=number, repeat=repeat)) / number
+
+def run(names, seconds, strict):
+    print("%-18s %10s %12s %12s %8s" % ("case", "size", "chjson MB/s", "json MB/s", "ratio"))
+    for name, factory, is_json in CASES:
+        if names and name not in names:
+            continue
+        doc = factory()
+        size = len(doc)
+        mbytes = size / 1e6
+        if strict and not is_json:
+            continue
+        ours = mbytes / _best(lambda: chjson.decode(doc, strict=strict), seconds)
+        if is_json:
+            theirs = mbytes / _best(lambda: json.loads(doc), seconds)
+            print("%-18s %10d %12.1f %12.1f %8.2f" % (name, size, ours, theirs, ours / theirs))
+        else:
+            print("%-18s %10d %12.1f %12s %8s" % (name, size, ours, "-", "-"))
+
+def main():
+    parser = argparse.ArgumentParser(description="chjson decoder benchmarks")
+    parser.add_argument("-n", "--seconds", type=float, default=1.0,
+                        help="approximate time to spend per case")
+    parser.add_argument("--strict", action="store_true",
+                        help="decode with strict=True (skips cases that aren't JSON)")
+    parser.add_argument("cases", nargs="*", help="cases to run (default: all)")
+    args = parser.parse_args()
+    run(args.cases, args.seconds, args.strict)
+
+if __name__ == '__main__':
+    main()
+
+# vim:tw=0:ts=4:sw=4:et
@@ -8,6 +8,9 @@
 // vim:tw=0:ts=4:sw=4:et
 
 #include <Python.h>
+#if PY_VERSION_HEX < 0x03030000
+    #error "chjson builds decoded strings with the PEP 393 API: Python 3.3+ is required."
+#endif
 #if PY_MAJOR_VERSION >= 3
     #if PY_MINOR_VERSION <= 3
         #include <accu.h>
@@ -16,18 +19,120 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <float.h>
 #include <math.h>
 #include <signal.h> // To set breakpoints with: raise(SIGINT);
+#include <string.h>
+#include <errno.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+    // decode_file() maps files into memory.
+    #define CHJSON_MMAP 1
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+#if defined(HAVE_UNISTD_H)
+    #include <unistd.h> // for decode_many()'s default number of threads
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #define CHJSON_SSE2 1
+    #include <emmintrin.h>
+#endif
+#if defined(CHJSON_SSE2) && (defined(__GNUC__) || defined(__clang__))
+    // The AVX2 scanners are compiled with a target attribute and only
+    // called if the CPU says it supports them (see have_avx2).
+    #define CHJSON_AVX2 1
+    #include <immintrin.h>
+#endif
+
+// Object keys repeat a lot (think arrays of records), so the decoder keeps
+// the str it made for each (short, escape-free) key in a small open-addressing
+// table, keyed on the key's code units, and hands out the same (interned)
+// object again when it sees the same key.
+#define KEY_CACHE_SIZE 256 // a power of two
+#define KEY_CACHE_PROBES 4
+#define KEY_CACHE_MAX_LENGTH 64
+
+typedef struct KeyCache {
+    PyObject *keys[KEY_CACHE_SIZE];
+    size_t hashes[KEY_CACHE_SIZE]; // of the code units, not Python's hash
+} KeyCache;
+
+// Big documents tend to be arrays of objects with the same keys, so the
+// decoder remembers the last key sequence (the object's "shape") seen at
+// each depth. Keys that arrive in that order are checked against the
+// shape's key objects directly, and the dict is then copied from a template
+// that already has all the keys, rather than grown one key at a time.
+#define SHAPE_MAX_DEPTH 32
+#define SHAPE_MAX_KEYS 64
+// A shape is only replaced after this many objects in a row didn't fit it,
+// so that alternating shapes at one depth don't keep replacing each other.
+#define SHAPE_MAX_MISSES 2
+
+typedef struct Shape {
+    PyObject *keys; // a tuple of the keys, in order, or NULL
+    PyObject *dict; // the keys, in order, each set to None
+    int misses;
+} Shape;
+
+// What a decoder remembers from one document to the next.
+typedef struct DecoderCache {
+    KeyCache keys;
+    Shape shapes[SHAPE_MAX_DEPTH];
+    int in_use;
+} DecoderCache;
+
+// A stack of arrays and objects (see Frame).
+typedef struct FrameStack {
+    struct Frame *frames;
+    Py_ssize_t size;
+    Py_ssize_t capacity;
+} FrameStack;
 
 typedef struct JSONData {
-    // MAYBE: Should this be/should we support wchar *?
-    char *str; // the actual json string
-    char *end; // pointer to the string end
-    char *ptr; // pointer to the current parsing position
-    int  all_unicode; // make all output strings unicode if true
-    int strict; // expect strict JSON format if true
-    long lineno;
-    long offset;
+    // The input's code units, which are Py_UCS1, Py_UCS2 or Py_UCS4,
+    // depending on the decoder variant (see chjson_decode.h).
+    void *str; // the actual json string
+    void *end; // pointer to the string end
+    void *ptr; // pointer to the current parsing position
+    long lineno; // the line that line_start is on, counting from 1
+    void *line_start; // the newline that started it (or str)
+    // A Decoder drops the input that it's done with, so these count what
+    // was dropped: the characters before str, and those on the line before
+    // line_start (if it's still line line_base_lineno).
+    Py_ssize_t position_base;
+    long line_base;
+    long line_base_lineno;
+    DecoderCache *cache;
+    // The arrays and objects being tokenized, and being built (which can
+    // lag behind, see tape_limit), innermost last.
+    FrameStack tokenizing;
+    FrameStack building;
+    Py_ssize_t max_depth; // how many frames there can be
+    // The tokenized input (see TapeEntry), which is built from starting at
+    // tape_read. Tokenizing pauses once there are tape_limit entries, so
+    // that they can be built (and the tape reused) while still in cache.
+    struct TapeEntry *tape;
+    Py_ssize_t tape_size;
+    Py_ssize_t tape_capacity;
+    Py_ssize_t tape_read;
+    Py_ssize_t tape_limit;
+    // Set by validate(), for which the tape's never built: numbers are only
+    // checked, not converted. But an integer with more digits than
+    // max_int_digits fails, as Python's int() would fail to convert it.
+    int is_validating;
+    Py_ssize_t max_int_digits;
+    // Why tokenizing stopped, if it failed: a DecodeErrorCode, and the
+    // position to report (ptr, lineno and line_start are left as they were).
+    int error;
+    void *error_at;
+    // A stack of decoded values, reused by all the arrays and objects
+    // being built.
+    PyObject **scratch;
+    Py_ssize_t scratch_size;
+    Py_ssize_t scratch_capacity;
 } JSONData;
 
 static PyObject *encode_object(PyObject *object);
@@ -39,16 +144,6 @@ static PyObject *encode_tuple(PyTupleObject *object);
 static PyObject *encode_list(PyListObject *object);
 static PyObject *encode_dict(PyDictObject *object);
 
-static PyObject *decode_json(JSONData *jsondata);
-static PyObject *decode_null(JSONData *jsondata);
-static PyObject *decode_bool(JSONData *jsondata);
-static PyObject *decode_string(JSONData *jsondata);
-static PyObject *decode_inf(JSONData *jsondata);
-static PyObject *decode_nan(JSONData *jsondata);
-static PyObject *decode_number(JSONData *jsondata);
-static PyObject *decode_array(JSONData *jsondata);
-static PyObject *decode_object(JSONData *jsondata);
-
 #define _string(x) #x
 #define string(x) _string(x)
 
@@ -103,7 +198,6 @@ typedef int Py_ssize_t;
 
 #if PY_MAJOR_VERSION >= 3
     #define PyInt_Check PyLong_Check
-    #define PyInt_FromString PyLong_FromUnicode
     //#define PyString_Check PyBytes_Check
     #define PyString_Check PyUnicode_Check
 #endif
@@ -208,981 +302,1396 @@ static PyMemberDef JSON_Error_members[] = {
 };
 */
 
-// *** JSONData "class" methods.
+// *** Block scanning.
+
+// Pretty-printed JSON is mostly indentation, so rather than testing one
+// character at a time, runs of blanks (spaces and tabs) are classified a
+// block at a time, and so are the ordinary characters inside strings. For
+// 1-byte input that's 32 bytes with AVX2, 16 bytes with SSE2, or 8 bytes
+// with SWAR on other little-endian machines; for 2-byte input, 8 code units
+// with SSE2. The scalar loops only have to look at newlines, comments,
+// escapes, and whatever ends the run.
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+    static __inline int
+    chjson_ctz32(unsigned int x)
+    {
+        unsigned long i;
+        _BitScanForward(&i, x);
+        return (int)i;
+    }
+#elif defined(__GNUC__) || defined(__clang__)
+    #define chjson_ctz32(x) __builtin_ctz(x)
+    #define chjson_ctz64(x) __builtin_ctzll(x)
+    #if !defined(CHJSON_SSE2) && PY_LITTLE_ENDIAN
+        #define CHJSON_SWAR 1
+    #endif
+#endif
+
+#ifdef CHJSON_AVX2
+// Set at module initialization, if the CPU supports AVX2.
+static int have_avx2 = False;
+#endif
+
+#ifdef CHJSON_SWAR
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_LOWS 0x7F7F7F7F7F7F7F7FULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+// Sets the high bit of every byte in word that is not zero.
+#define swar_nonzero(word) \
+    (((((word) & SWAR_LOWS) + SWAR_LOWS) | (word)) & SWAR_HIGHS)
+// Sets the high bit of every byte in word that is zero.
+#define swar_zero(word) \
+    (~(((((word) & SWAR_LOWS) + SWAR_LOWS) | (word))) & SWAR_HIGHS)
+// Sets the high bit of every byte in word that is a control character.
+#define swar_control(word) \
+    (~(((word) | SWAR_HIGHS) - (SWAR_ONES * 0x20)) & ~(word) & SWAR_HIGHS)
+#endif
+
+// The skip_blanks_*() functions return a pointer to the first code unit at
+// or after ptr that is neither a space nor a tab (or end, if there is none).
 
-void jsondata_mv_ptr(JSONData *jsondata, long n_chars, long n_lines)
+// The scan_string_*() functions return a pointer to the first code unit at
+// or after ptr inside a string that needs a closer look: the closing
+// quote_delim, a backslash, a control character, or a character at or above
+// stop_at (which is how the caller keeps track of the widest character in
+// the string); or end, if there is none.
+
+// The scan_comment_*() functions return a pointer to the first code unit at
+// or after ptr that could end a comment or a line: a NUL, LF, CR or star
+// (which is '*' in a block comment, and just '\n' again in a line comment);
+// or end, if there is none.
+
+#ifdef CHJSON_AVX2
+__attribute__((target("avx2")))
+static Py_UCS1 *
+skip_blanks_avx2(Py_UCS1 *ptr, Py_UCS1 *end)
 {
-    if (n_chars > 0) {
-        jsondata->ptr += n_chars;
-        jsondata->offset += n_chars;
-    }
-    if (n_lines > 0) {
-        jsondata->offset = 0;
-        jsondata->lineno += n_lines;
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    const __m256i tabs = _mm256_set1_epi8('\t');
+    __m256i block;
+    unsigned int mask;
+
+    while (end - ptr >= 32) {
+        block = _mm256_loadu_si256((const __m256i *)ptr);
+        mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(block, spaces),
+                _mm256_cmpeq_epi8(block, tabs)
+            )
+        );
+        if (mask != 0xFFFFFFFF) {
+            return ptr + chjson_ctz32(~mask);
+        }
+        ptr += 32;
     }
+    return ptr;
 }
 
-void skip_spaces(JSONData *jsondata)
+__attribute__((target("avx2")))
+static Py_UCS1 *
+scan_string_avx2(Py_UCS1 *ptr, Py_UCS1 *end, Py_UCS1 quote_delim, int stop_at_high)
 {
-    int prev_ch_was_LF = False;
-    int prev_ch_was_CR = False;
-    int prev_ch_was_solidus = False;
-    int in_multiline_comment = False;
-
-    char ch = *(jsondata)->ptr;
-    //? wchar ch = *(jsondata)->ptr;
-
-    while (True) {
-        if (ch == '\0') {
-            break;
-        }
-        else if (isspace(ch)) {
-            // https://en.wikipedia.org/wiki/Newline
-            if (ch == '\n') {
-                if (!prev_ch_was_CR) {
-                    jsondata_mv_ptr(jsondata, 0, 1);
-                    prev_ch_was_LF = True;
-                }
-                else {
-                    // offset already reset and lineno incremented, but identify, e.g.,
-                    // \r\n\n\r as two lines. Not that that should ever happen.
-                    prev_ch_was_LF = False;
-                }
-                prev_ch_was_CR = False;
-            }
-            else if (ch == '\r') {
-                if (!prev_ch_was_LF) {
-                    jsondata_mv_ptr(jsondata, 0, 1);
-                    prev_ch_was_CR = True;
-                }
-                else {
-                    // offset already reset and lineno incremented, but identify, e.g.,
-                    // \r\n\n\r as two lines. Not that that should ever happen.
-                    prev_ch_was_CR = False;
-                }
-                prev_ch_was_LF = False;
-            }
-            else {
-                prev_ch_was_CR = False;
-                prev_ch_was_LF = False;
-            }
-        }
-        else if (jsondata->strict) {
-            // MEH: We could see if there _is_ a comment following and
-            // add that as a hint to any error output, but whatever.
-            break;
+    const __m256i quotes = _mm256_set1_epi8((char)quote_delim);
+    const __m256i backslashes = _mm256_set1_epi8('\\');
+    const __m256i below_space = _mm256_set1_epi8(0x20);
+    const __m256i max_control = _mm256_set1_epi8(0x1F);
+    __m256i block, special;
+    unsigned int mask;
+
+    while (end - ptr >= 32) {
+        block = _mm256_loadu_si256((const __m256i *)ptr);
+        special = _mm256_or_si256(
+            _mm256_cmpeq_epi8(block, quotes),
+            _mm256_cmpeq_epi8(block, backslashes)
+        );
+        if (stop_at_high) {
+            // Signed compare: control characters and bytes >= 0x80.
+            special = _mm256_or_si256(special, _mm256_cmpgt_epi8(below_space, block));
         }
         else {
-            if (in_multiline_comment) {
-                if (('*' == ch) && ('/' == *((jsondata)->ptr + 1))) {
-                    jsondata->ptr++;
-                    jsondata->offset++;
-                    in_multiline_comment = False;
-                }
-            }
-            else if (ch == '/') {
-                if (prev_ch_was_solidus) {
-                    // A single-line comment.
-                    ch = *(++((jsondata)->ptr));
-                    jsondata->offset++;
-                    while ((ch != '\0') && (ch != '\r') && (ch != '\n')) {
-                        ch = *(++((jsondata)->ptr));
-                        jsondata->offset++;
-                    }
-                    // Let newline do it: jsondata_mv_ptr(jsondata, 0, 1);
-                    prev_ch_was_solidus = False;
-                    continue; // We already got the next ch.
-                }
-                else {
-                    prev_ch_was_solidus = True;
-                }
-            }
-            else if ((ch == '*') && (prev_ch_was_solidus)) {
-                // A multi-line comment.
-                in_multiline_comment = True;
-                prev_ch_was_solidus = False;
-            }
-            else {
-                if (prev_ch_was_solidus) {
-                    // Deconsume the sole slash.
-                    (jsondata)->ptr--;
-                    jsondata->offset -= 1;
-                }
-                prev_ch_was_solidus = False;
-                break;
-            }
+            special = _mm256_or_si256(special, _mm256_cmpeq_epi8(
+                _mm256_min_epu8(block, max_control), block));
         }
-
-        ch = *(++((jsondata)->ptr));
-        jsondata->offset++;
+        mask = (unsigned int)_mm256_movemask_epi8(special);
+        if (mask != 0) {
+            return ptr + chjson_ctz32(mask);
+        }
+        ptr += 32;
     }
+    return ptr;
 }
 
-// *** Decoding
-
-static PyObject *
-decode_null(JSONData *jsondata)
+__attribute__((target("avx2")))
+static Py_UCS1 *
+scan_comment_avx2(Py_UCS1 *ptr, Py_UCS1 *end, Py_UCS1 star)
 {
-    ptrdiff_t left;
-
-    left = jsondata->end - jsondata->ptr;
-
-    if ((left >= 4) && (strncmp(jsondata->ptr, "null", 4) == 0)) {
-        jsondata_mv_ptr(jsondata, 4, 0);
-        Py_INCREF(Py_None);
-        return Py_None;
-    }
-    else {
-        PyErr_Format(
-            JSON_DecodeError,
-            "cannot parse JSON description as null: \"%.20s\""
-                " (lineno %ld, offset %ld)",
-            jsondata->ptr, jsondata->lineno, jsondata->offset
+    const __m256i nuls = _mm256_setzero_si256();
+    const __m256i lfs = _mm256_set1_epi8('\n');
+    const __m256i crs = _mm256_set1_epi8('\r');
+    const __m256i stars = _mm256_set1_epi8((char)star);
+    __m256i block;
+    unsigned int mask;
+
+    while (end - ptr >= 32) {
+        block = _mm256_loadu_si256((const __m256i *)ptr);
+        mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(block, nuls), _mm256_cmpeq_epi8(block, lfs)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(block, crs), _mm256_cmpeq_epi8(block, stars))
+            )
         );
-        return NULL;
+        if (mask != 0) {
+            return ptr + chjson_ctz32(mask);
+        }
+        ptr += 32;
     }
+    return ptr;
 }
+#endif
 
-static PyObject *
-decode_bool(JSONData *jsondata)
+static Py_UCS1 *
+skip_blanks_ucs1(Py_UCS1 *ptr, Py_UCS1 *end)
 {
-    ptrdiff_t left;
-
-    left = jsondata->end - jsondata->ptr;
+    #if defined(CHJSON_SSE2)
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i tabs = _mm_set1_epi8('\t');
+    __m128i block;
+    unsigned int mask;
+    #elif defined(CHJSON_SWAR)
+    unsigned long long word, blanks;
+    #endif
 
-    if ((left >= 4) && (strncmp(jsondata->ptr, "true", 4) == 0)) {
-        jsondata_mv_ptr(jsondata, 4, 0);
-        Py_INCREF(Py_True);
-        return Py_True;
+    #ifdef CHJSON_AVX2
+    if (have_avx2) {
+        ptr = skip_blanks_avx2(ptr, end);
     }
-    else if ((left >= 5) && (strncmp(jsondata->ptr, "false", 5) == 0)) {
-        jsondata_mv_ptr(jsondata, 5, 0);
-        Py_INCREF(Py_False);
-        return Py_False;
-    }
-    else {
-        PyErr_Format(
-            JSON_DecodeError,
-            "cannot parse JSON description as bool: \"%.20s\""
-                " (lineno %ld, offset %ld)",
-            jsondata->ptr, jsondata->lineno, jsondata->offset
+    #endif
+
+    #if defined(CHJSON_SSE2)
+    while (end - ptr >= 16) {
+        block = _mm_loadu_si128((const __m128i *)ptr);
+        mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, spaces), _mm_cmpeq_epi8(block, tabs))
         );
-        return NULL;
+        if (mask != 0xFFFF) {
+            return ptr + chjson_ctz32(~mask);
+        }
+        ptr += 16;
+    }
+    #elif defined(CHJSON_SWAR)
+    while (end - ptr >= 8) {
+        memcpy(&word, ptr, 8);
+        // A byte is not blank if it differs from both ' ' and '\t'.
+        blanks = swar_nonzero(word ^ (SWAR_ONES * ' '))
+                 & swar_nonzero(word ^ (SWAR_ONES * '\t'));
+        if (blanks != 0) {
+            return ptr + (chjson_ctz64(blanks) >> 3);
+        }
+        ptr += 8;
     }
+    #endif
+
+    while ((ptr < end) && ((*ptr == ' ') || (*ptr == '\t'))) {
+        ptr++;
+    }
+    return ptr;
 }
 
-static PyObject *
-decode_string(JSONData *jsondata)
+static Py_UCS1 *
+scan_string_ucs1(Py_UCS1 *ptr, Py_UCS1 *end, Py_UCS1 quote_delim, Py_UCS4 stop_at)
 {
-    PyObject *object;
-    int c, escaping, has_unicode, string_escape;
-    Py_ssize_t len;
-    char *ptr;
-
-    char quote_delim;
-
-    int was_newline_LF, was_newline_CR, clean_newlines_and_escaped_soliduses;
-    char *clean_ptr, *clean_walk;
-    int clean_iter;
+    // 1-byte input only ever needs to know about the first non-ASCII byte.
+    int stop_at_high = (stop_at <= 0x80);
+    #if defined(CHJSON_SSE2)
+    const __m128i quotes = _mm_set1_epi8((char)quote_delim);
+    const __m128i backslashes = _mm_set1_epi8('\\');
+    const __m128i below_space = _mm_set1_epi8(0x20);
+    const __m128i max_control = _mm_set1_epi8(0x1F);
+    __m128i block, special;
+    unsigned int mask;
+    #elif defined(CHJSON_SWAR)
+    unsigned long long word, special;
+    #endif
+    Py_UCS1 c;
 
-    quote_delim = (jsondata->strict) ? '"' : (*jsondata->ptr); // " or '
+    #ifdef CHJSON_AVX2
+    if (have_avx2) {
+        ptr = scan_string_avx2(ptr, end, quote_delim, stop_at_high);
+    }
+    #endif
 
-    // look for the closing quote
-    escaping = has_unicode = string_escape = False;
-    was_newline_LF = was_newline_CR = clean_newlines_and_escaped_soliduses = False;
-    ptr = jsondata->ptr + 1;
-    while (True) {
-        c = *ptr;
-        if (c == 0) {
-            PyErr_Format(
-                JSON_DecodeError,
-                "unterminated string starting at position " SSIZE_T_F
-                    " (lineno %ld, offset %ld)",
-                (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                jsondata->lineno, jsondata->offset
-            );
-            return NULL;
-        }
-        if (!escaping) {
-            if (c == '\\') {
-                escaping = True;
-            }
-            // OC:
-            //  else if (c == '"') {
-            else if (c == quote_delim) {
-                break;
-            }
-            else if (!isascii(c)) {
-                has_unicode = True;
-            }
-            // [lb] added this: the original cjson supports multi-line
-            // quoted strings, which the json standard does not support
-            // (so this was missing). We could let it slide, but Python's
-            // demjson allows multi-line quoted strings using trailing
-            // slash line continuation indicators -- which is also standard
-            // in other languages, like Bash -- so we should follow convention.
-            else if (
-                ((c == '\n') || (c == '\r'))
-                && ((jsondata->strict)
-                    || (   (!((was_newline_LF) && (c == '\r')))
-                        && (!((was_newline_CR) && (c == '\n')))))
-            ) {
-                PyErr_Format(
-                    JSON_DecodeError,
-                    (!jsondata->strict)
-                        ? "invalid string contains newline (hint: use backslash escape continuator) "
-                          "starting at position " SSIZE_T_F " (lineno %ld, offset %ld)"
-                        : "invalid string contains newline "
-                          "starting at position " SSIZE_T_F " (lineno %ld, offset %ld)",
-                    (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                    jsondata->lineno, jsondata->offset
-                );
-                return NULL;
-            }
-            // else, ignore this char.
-            was_newline_LF = False;
-            was_newline_CR = False;
+    #if defined(CHJSON_SSE2)
+    while (end - ptr >= 16) {
+        block = _mm_loadu_si128((const __m128i *)ptr);
+        special = _mm_or_si128(
+            _mm_cmpeq_epi8(block, quotes),
+            _mm_cmpeq_epi8(block, backslashes)
+        );
+        if (stop_at_high) {
+            // Signed compare: control characters and bytes >= 0x80.
+            special = _mm_or_si128(special, _mm_cmplt_epi8(block, below_space));
         }
         else {
-            // chjson:
-            if (c == quote_delim) {
-                string_escape = True;
-            }
-            else if ((c == '\n') && (!jsondata->strict)) {
-                was_newline_LF = True;
-                clean_newlines_and_escaped_soliduses = True;
-            }
-            else if ((c == '\r') && (!jsondata->strict)) {
-                was_newline_CR = True;
-                clean_newlines_and_escaped_soliduses = True;
-            }
-            else {
-                switch(c) {
-                case 'u':
-                    has_unicode = True;
-                    break;
-                // OC:
-                //  case '"':
-                case 'r':
-                case 'n':
-                case 't':
-                case 'b':
-                case 'f':
-                case '\\':
-                    string_escape = True;
-                    break;
-                // The json spec. allows escaping forward slashes, e.g., \/
-                // which helps when embedding JSON in a <script> tag, which
-                // doesn't allow </ inside strings.
-                case '/':
-                    // NOTE: The decode fcn. we call, e.g., PyBytes_DecodeEscape,
-                    //       doesn't think solidus characters are escaped, so we
-                    //       have to remove the preceeding escape character.
-                    clean_newlines_and_escaped_soliduses = True;
-                    break;
-                // MAYBE: default: Do we care?
-                default:
-                    PyErr_Format(
-                        JSON_DecodeError,
-                        "invalid string contains unrecognized backslash escape "
-                            "starting at position " SSIZE_T_F " (lineno %ld, offset %ld)",
-                        (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                        jsondata->lineno, jsondata->offset
-                    );
-                    return NULL;
-                }
-            }
-            escaping = False;
+            special = _mm_or_si128(special, _mm_cmpeq_epi8(
+                _mm_min_epu8(block, max_control), block));
         }
-        ptr++;
-    }
-    if (escaping) {
-        PyErr_Format(
-            JSON_DecodeError,
-            "invalid string contains trailing backslash escape "
-                "starting at position " SSIZE_T_F " (lineno %ld, offset %ld)",
-            (Py_ssize_t)(jsondata->ptr - jsondata->str),
-            jsondata->lineno, jsondata->offset
-        );
-        return NULL;
+        mask = (unsigned int)_mm_movemask_epi8(special);
+        if (mask != 0) {
+            return ptr + chjson_ctz32(mask);
+        }
+        ptr += 16;
+    }
+    #elif defined(CHJSON_SWAR)
+    while (end - ptr >= 8) {
+        memcpy(&word, ptr, 8);
+        special = swar_zero(word ^ (SWAR_ONES * quote_delim))
+                  | swar_zero(word ^ (SWAR_ONES * '\\'))
+                  | swar_control(word);
+        if (stop_at_high) {
+            special |= word & SWAR_HIGHS;
+        }
+        if (special != 0) {
+            return ptr + (chjson_ctz64(special) >> 3);
+        }
+        ptr += 8;
     }
+    #endif
 
-    len = ptr - jsondata->ptr - 1;
-
-    // Copy the string buffer and remove line continuations.
-    if (clean_newlines_and_escaped_soliduses) {
-        // Allocate new buffer.
-        clean_ptr = (char *)PyMem_Malloc(len + 1); // Add one for NULL;
-        if (clean_ptr == NULL) {
-            // MAYBE: Need to worry about PyErr_Format, or was it set?
-            //return NULL;
-            return PyErr_NoMemory();
-        }
-        clean_walk = clean_ptr;
-        // Copy characters, ignoring escaped newlines and solidi.
-        // We start at one to skip the quote.
-        for (clean_iter = 1; clean_iter <= len; clean_iter++) {
-            c = jsondata->ptr[clean_iter];
-            if (c == '\\') {
-                if ((clean_iter + 1) <= len) {
-                    if (
-                           (jsondata->ptr[clean_iter + 1] == '\r')
-                        || (jsondata->ptr[clean_iter + 1] == '\n')
-                    ) {
-                        // Skip the line continuation but keep the newline(s).
-                        *clean_walk++ = jsondata->ptr[clean_iter + 1];
-                        // Only increment once because for loop will do another.
-                        clean_iter += 1;
-                        if ((clean_iter + 1) <= len) {
-                            if (
-                                   (jsondata->ptr[clean_iter + 1] == '\r')
-                                || (jsondata->ptr[clean_iter + 1] == '\n')
-                            ) {
-                                *clean_walk++ = jsondata->ptr[clean_iter + 1];
-                                clean_iter += 1; // Skip second newline.
-                            }
-                        }
-                    }
-                    else if (jsondata->ptr[clean_iter + 1] == '/') {
-                        // An escaped solidus. We'll just loop and the
-                        // solidus will be copied, but not the escape.
-                    }
-                    else {
-                        // A different escaped character, so copy the escape.
-                        *clean_walk++ = c;
-                    }
-                }
-                else {
-                    // The string ends in backslash, so above parsing would
-                    // have bailed on error.
-                    // MAYBE: assert false; // This code should be unreachable.
-                    PyErr_Format(
-                        JSON_DecodeError,
-                        "unexpected parse error: string ends in stray backslash escape "
-                            "starting at position " SSIZE_T_F " (lineno %ld, offset %ld)",
-                        (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                        jsondata->lineno, jsondata->offset
-                    );
-                    return NULL;
-                }
-            }
-            else {
-                // Not an escape character.
-                *clean_walk++ = c;
-            }
+    while (ptr < end) {
+        c = *ptr;
+        if (
+            (c == quote_delim)
+            || (c == '\\')
+            || (c < 0x20)
+            || ((c >= 0x80) && stop_at_high)
+        ) {
+            break;
         }
-        // We really don't need a trailing NULL since we're explict about
-        // the length, but it's nice being complete.
-        *clean_walk++ = 0;
-        // Update the len.
-        len = clean_walk - clean_ptr - 1; // Sub 1 for NULL.
-        // Not necessary: PyMem_Realloc(clean_ptr, len);
+        ptr++;
     }
-    else {
-        clean_ptr = jsondata->ptr + 1; // Skip the opening quote.
+    return ptr;
+}
+
+static Py_UCS1 *
+scan_comment_ucs1(Py_UCS1 *ptr, Py_UCS1 *end, Py_UCS1 star)
+{
+    #if defined(CHJSON_SSE2)
+    const __m128i nuls = _mm_setzero_si128();
+    const __m128i lfs = _mm_set1_epi8('\n');
+    const __m128i crs = _mm_set1_epi8('\r');
+    const __m128i stars = _mm_set1_epi8((char)star);
+    __m128i block;
+    unsigned int mask;
+    #elif defined(CHJSON_SWAR)
+    unsigned long long word, special;
+    #endif
+    Py_UCS1 c;
+
+    #ifdef CHJSON_AVX2
+    if (have_avx2) {
+        ptr = scan_comment_avx2(ptr, end, star);
     }
+    #endif
 
-    if (has_unicode || jsondata->all_unicode) {
-        object = PyUnicode_DecodeUnicodeEscape(clean_ptr, len, NULL);
+    #if defined(CHJSON_SSE2)
+    while (end - ptr >= 16) {
+        block = _mm_loadu_si128((const __m128i *)ptr);
+        mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(block, nuls), _mm_cmpeq_epi8(block, lfs)),
+                _mm_or_si128(_mm_cmpeq_epi8(block, crs), _mm_cmpeq_epi8(block, stars))
+            )
+        );
+        if (mask != 0) {
+            return ptr + chjson_ctz32(mask);
+        }
+        ptr += 16;
+    }
+    #elif defined(CHJSON_SWAR)
+    while (end - ptr >= 8) {
+        memcpy(&word, ptr, 8);
+        special = swar_zero(word)
+                  | swar_zero(word ^ (SWAR_ONES * '\n'))
+                  | swar_zero(word ^ (SWAR_ONES * '\r'))
+                  | swar_zero(word ^ (SWAR_ONES * star));
+        if (special != 0) {
+            return ptr + (chjson_ctz64(special) >> 3);
+        }
+        ptr += 8;
     }
-    else if (string_escape) {
-        #if PY_MAJOR_VERSION >= 3
-        PyObject *obj = PyBytes_DecodeEscape(clean_ptr, len, NULL, 0, NULL);
-        object = PyUnicode_FromEncodedObject(obj, /*encoding=*/NULL, /*errors=*/NULL);
-        Py_DECREF(obj);
-        if (object == NULL) {
-            // MAYBE: Set error object? Or did Py*_*() command set it?
-            return NULL;
+    #endif
+
+    while (ptr < end) {
+        c = *ptr;
+        if ((c == '\0') || (c == '\n') || (c == '\r') || (c == star)) {
+            break;
         }
-        #else
-        object = PyString_DecodeEscape(clean_ptr, len, NULL, 0, NULL);
-        #endif
+        ptr++;
     }
-    else {
-        object = PYUNICODE_FROMSTRINGANDSIZE(clean_ptr, len);
+    return ptr;
+}
+
+static Py_UCS2 *
+skip_blanks_ucs2(Py_UCS2 *ptr, Py_UCS2 *end)
+{
+    #if defined(CHJSON_SSE2)
+    const __m128i spaces = _mm_set1_epi16(' ');
+    const __m128i tabs = _mm_set1_epi16('\t');
+    __m128i block;
+    unsigned int mask;
+
+    while (end - ptr >= 8) {
+        block = _mm_loadu_si128((const __m128i *)ptr);
+        mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi16(block, spaces), _mm_cmpeq_epi16(block, tabs))
+        );
+        if (mask != 0xFFFF) {
+            return ptr + (chjson_ctz32(~mask) >> 1);
+        }
+        ptr += 8;
     }
+    #endif
 
-    if (clean_newlines_and_escaped_soliduses) {
-        PyMem_Free(clean_ptr);
+    while ((ptr < end) && ((*ptr == ' ') || (*ptr == '\t'))) {
+        ptr++;
     }
-    // Not necessary, but we could reset len:
-    //  len = ptr - jsondata->ptr - 1;
+    return ptr;
+}
 
-    if (object == NULL) {
-        PyObject *type, *value, *tb, *reason;
-
-        PyErr_Fetch(&type, &value, &tb);
-        if (type == NULL) {
-            PyErr_Format(
-                JSON_DecodeError,
-                "invalid string starting at position " SSIZE_T_F
-                    " (lineno %ld, offset %ld)",
-                (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                jsondata->lineno, jsondata->offset
-            );
+static Py_UCS2 *
+scan_string_ucs2(Py_UCS2 *ptr, Py_UCS2 *end, Py_UCS2 quote_delim, Py_UCS4 stop_at)
+{
+    Py_UCS2 c;
+    #if defined(CHJSON_SSE2)
+    // SSE2 only compares signed 16-bit integers, so flip the sign bits.
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    const __m128i quotes = _mm_set1_epi16((short)quote_delim);
+    const __m128i backslashes = _mm_set1_epi16('\\');
+    const __m128i below_space = _mm_set1_epi16((short)(0x20 ^ 0x8000));
+    const __m128i below_stop = _mm_set1_epi16((short)(((stop_at - 1) & 0xFFFF) ^ 0x8000));
+    __m128i block, biased, special;
+    unsigned int mask;
+
+    while (end - ptr >= 8) {
+        block = _mm_loadu_si128((const __m128i *)ptr);
+        biased = _mm_xor_si128(block, bias);
+        special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi16(block, quotes), _mm_cmpeq_epi16(block, backslashes)),
+            _mm_cmplt_epi16(biased, below_space)
+        );
+        if (stop_at <= 0xFFFF) {
+            special = _mm_or_si128(special, _mm_cmpgt_epi16(biased, below_stop));
         }
-        else {
-            if (PyErr_GivenExceptionMatches(type, PyExc_UnicodeDecodeError)) {
-                reason = PyObject_GetAttrString(value, "reason");
-                PyErr_Format(
-                    JSON_DecodeError,
-                    "cannot decode string starting at position " SSIZE_T_F
-                        ": %s (lineno %ld, offset %ld)",
-                    (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                    #if PY_MAJOR_VERSION >= 3
-                    reason ? PyUnicode_AsUTF8(reason) : "bad format",
-                    #else
-                    reason ? PyString_AsString(reason) : "bad format",
-                    #endif
-                    jsondata->lineno, jsondata->offset
-                );
-                Py_XDECREF(reason);
-            }
-            else {
-                PyErr_Format(
-                    JSON_DecodeError,
-                    "invalid string starting at position " SSIZE_T_F
-                        " (lineno %ld, offset %ld)",
-                    (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                    jsondata->lineno, jsondata->offset
-                );
-            }
+        mask = (unsigned int)_mm_movemask_epi8(special);
+        if (mask != 0) {
+            return ptr + (chjson_ctz32(mask) >> 1);
         }
-        Py_XDECREF(type);
-        Py_XDECREF(value);
-        Py_XDECREF(tb);
-    }
-    else {
-        //jsondata->ptr = ptr+1;
-        //jsondata_mv_ptr(jsondata, (Py_ssize_t)(ptr + 1 - jsondata->ptr) / sizeof(char *), 0);
-        jsondata_mv_ptr(jsondata, (Py_ssize_t)(ptr + 1 - jsondata->ptr), 0);
+        ptr += 8;
     }
+    #endif
 
-    return object;
+    while (ptr < end) {
+        c = *ptr;
+        if ((c == quote_delim) || (c == '\\') || (c < 0x20) || (c >= stop_at)) {
+            break;
+        }
+        ptr++;
+    }
+    return ptr;
 }
 
-static PyObject *
-decode_inf(JSONData *jsondata)
+static Py_UCS2 *
+scan_comment_ucs2(Py_UCS2 *ptr, Py_UCS2 *end, Py_UCS2 star)
 {
-    PyObject *object;
-    ptrdiff_t left;
-
-    left = jsondata->end - jsondata->ptr;
-
-    if ((left >= 8) && (strncmp(jsondata->ptr, "Infinity", 8) == 0)) {
-        jsondata_mv_ptr(jsondata, 8, 0);
-        object = PyFloat_FromDouble(INFINITY);
-        return object;
-    }
-    else if ((left >= 9) && (strncmp(jsondata->ptr, "+Infinity", 9) == 0)) {
-        jsondata_mv_ptr(jsondata, 9, 0);
-        object = PyFloat_FromDouble(INFINITY);
-        return object;
-    }
-    else if ((left >= 9) && (strncmp(jsondata->ptr, "-Infinity", 9) == 0)) {
-        jsondata_mv_ptr(jsondata, 9, 0);
-        object = PyFloat_FromDouble(-INFINITY);
-        return object;
-    }
-    else {
-        PyErr_Format(
-            JSON_DecodeError,
-            "cannot parse JSON description as Inf.: %.20s"
-                " (lineno %ld, offset %ld)",
-            jsondata->ptr, jsondata->lineno, jsondata->offset
+    Py_UCS2 c;
+    #if defined(CHJSON_SSE2)
+    const __m128i nuls = _mm_setzero_si128();
+    const __m128i lfs = _mm_set1_epi16('\n');
+    const __m128i crs = _mm_set1_epi16('\r');
+    const __m128i stars = _mm_set1_epi16((short)star);
+    __m128i block;
+    unsigned int mask;
+
+    while (end - ptr >= 8) {
+        block = _mm_loadu_si128((const __m128i *)ptr);
+        mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi16(block, nuls), _mm_cmpeq_epi16(block, lfs)),
+                _mm_or_si128(_mm_cmpeq_epi16(block, crs), _mm_cmpeq_epi16(block, stars))
+            )
         );
-        return NULL;
+        if (mask != 0) {
+            return ptr + (chjson_ctz32(mask) >> 1);
+        }
+        ptr += 8;
+    }
+    #endif
+
+    while (ptr < end) {
+        c = *ptr;
+        if ((c == '\0') || (c == '\n') || (c == '\r') || (c == star)) {
+            break;
+        }
+        ptr++;
     }
+    return ptr;
 }
 
-static PyObject *
-decode_nan(JSONData *jsondata)
+static Py_UCS4 *
+skip_blanks_ucs4(Py_UCS4 *ptr, Py_UCS4 *end)
 {
-    PyObject *object;
-    ptrdiff_t left;
+    while ((ptr < end) && ((*ptr == ' ') || (*ptr == '\t'))) {
+        ptr++;
+    }
+    return ptr;
+}
 
-    left = jsondata->end - jsondata->ptr;
+static Py_UCS4 *
+scan_string_ucs4(Py_UCS4 *ptr, Py_UCS4 *end, Py_UCS4 quote_delim, Py_UCS4 stop_at)
+{
+    Py_UCS4 c;
 
-    if ((left >= 3) && (strncmp(jsondata->ptr, "NaN", 3) == 0)) {
-        jsondata_mv_ptr(jsondata, 3, 0);
-        object = PyFloat_FromDouble(NAN);
-        return object;
-    }
-    else {
-        PyErr_Format(
-            JSON_DecodeError,
-            "cannot parse JSON description as NaN: %.20s"
-                " (lineno %ld, offset %ld)",
-            jsondata->ptr, jsondata->lineno, jsondata->offset
-        );
-        return NULL;
+    while (ptr < end) {
+        c = *ptr;
+        if ((c == quote_delim) || (c == '\\') || (c < 0x20) || (c >= stop_at)) {
+            break;
+        }
+        ptr++;
     }
+    return ptr;
 }
 
-#define skipDigits(ptr) \
-    while (isdigit(*(ptr))) { \
-        (ptr)++; \
+static Py_UCS4 *
+scan_comment_ucs4(Py_UCS4 *ptr, Py_UCS4 *end, Py_UCS4 star)
+{
+    Py_UCS4 c;
+
+    while (ptr < end) {
+        c = *ptr;
+        if ((c == '\0') || (c == '\n') || (c == '\r') || (c == star)) {
+            break;
+        }
+        ptr++;
     }
+    return ptr;
+}
 
-static PyObject *
-decode_number(JSONData *jsondata)
+// *** Decoding
+
+// The decoder (chjson_decode.h) is compiled once per PEP 393 kind (and
+// once more for UTF-8), and reads the input through these, which cast
+// JSONData's pointers to the variant's JSON_CHAR.
+#define JSON_STR(jsondata) ((JSON_CHAR *)(jsondata)->str)
+#define JSON_END(jsondata) ((JSON_CHAR *)(jsondata)->end)
+#define JSON_PTR(jsondata) ((JSON_CHAR *)(jsondata)->ptr)
+// The code unit at p, or NUL at (and past) end: the input needn't be
+// NUL-terminated, but the decoder stops at the end as if it were.
+#define JSON_PEEK(p, end) (((p) < (end)) ? *(p) : 0)
+// Positions are in characters, which UTF-8 input has to count.
+#define JSON_DISTANCE(from, to) \
+    ((JSON_UTF8) \
+        ? utf8_count((const Py_UCS1 *)(from), (const Py_UCS1 *)(to)) \
+        : (Py_ssize_t)((JSON_CHAR *)(to) - (JSON_CHAR *)(from)))
+#define JSON_POS(jsondata, p) \
+    ((jsondata)->position_base + JSON_DISTANCE(JSON_STR(jsondata), (p)))
+// The offset reported with lineno: how far ptr is past the newline that
+// started its line (or past the start of the input, on the first line).
+#define JSON_OFFSET(jsondata) \
+    ((long)JSON_DISTANCE((jsondata)->line_start, JSON_PTR(jsondata)) \
+        + (((jsondata)->lineno == (jsondata)->line_base_lineno) ? (jsondata)->line_base : 0))
+
+// Every byte's lexical class, as a set of flags, so that the decoder can tell
+// what's next with one lookup rather than a chain of comparisons.
+#define CC_SPACE        0x01    // \t \n \v \f \r and space
+#define CC_NEWLINE      0x02    // \n \r
+#define CC_DIGIT        0x04    // 0-9
+#define CC_NUMBER       0x08    // what a number can start with: 0-9 + - .
+#define CC_STRUCTURAL   0x10    // [ ] { } , :
+#define CC_QUOTE        0x20    // " '
+#define CC_COMMENT      0x40    // / (which starts a comment, unless strict)
+#define CC_HIGH         0x80    // not ASCII
+
+#define SP CC_SPACE
+#define NL CC_NEWLINE
+#define DG (CC_DIGIT | CC_NUMBER)
+#define NM CC_NUMBER
+#define ST CC_STRUCTURAL
+#define QT CC_QUOTE
+#define CM CC_COMMENT
+#define HI CC_HIGH
+
+static const unsigned char char_class[256] = {
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x00
+    0,  SP, SP|NL, SP, SP, SP|NL, 0, 0,     // 0x08
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x10
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x18
+    SP, 0,  QT, 0,  0,  0,  0,  QT,         // 0x20 sp ! " # $ % & '
+    0,  0,  0,  NM, ST, NM, NM, CM,         // 0x28 ( ) * + , - . /
+    DG, DG, DG, DG, DG, DG, DG, DG,         // 0x30 0 1 2 3 4 5 6 7
+    DG, DG, ST, 0,  0,  0,  0,  0,          // 0x38 8 9 : ; < = > ?
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x40
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x48
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x50
+    0,  0,  0,  ST, 0,  ST, 0,  0,          // 0x58 X Y Z [ \ ] ^ _
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x60
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x68
+    0,  0,  0,  0,  0,  0,  0,  0,          // 0x70
+    0,  0,  0,  ST, 0,  ST, 0,  0,          // 0x78 x y z { | } ~
+    HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI,
+    HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI,
+    HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI,
+    HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI,
+    HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI,
+    HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI,
+    HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI,
+    HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI, HI,
+};
+
+#undef SP
+#undef NL
+#undef DG
+#undef NM
+#undef ST
+#undef QT
+#undef CM
+#undef HI
+
+// The class of a code unit of any width: past 0xFF, it's just not ASCII.
+#define CHAR_CLASS(c) \
+    (((Py_UCS4)(c) < 0x100) ? char_class[(c)] : CC_HIGH)
+
+// Only ASCII whitespace and digits count, whatever the code unit's width.
+#define JSON_ISSPACE(c) (CHAR_CLASS(c) & CC_SPACE)
+#define JSON_ISDIGIT(c) (CHAR_CLASS(c) & CC_DIGIT)
+
+// Any run of up to this many digits fits in an unsigned long long.
+#define MAX_INT_DIGITS 19
+
+#if PY_LITTLE_ENDIAN
+// Returns the value of the eight ASCII digits at ptr, which the caller has
+// already checked are digits: the digits are paired up, then the pairs,
+// then the quads, each step a single multiply.
+static unsigned long long
+parse_eight_digits(const Py_UCS1 *ptr)
 {
-    PyObject *object, *str;
-    int is_float;
-    char *ptr;
+    unsigned long long word;
+
+    memcpy(&word, ptr, 8);
+    word &= 0x0F0F0F0F0F0F0F0FULL;
+    word = (word * 10 + (word >> 8)) & 0x00FF00FF00FF00FFULL;
+    word = (word * 100 + (word >> 16)) & 0x0000FFFF0000FFFFULL;
+    word = (word * 10000 + (word >> 32)) & 0x00000000FFFFFFFFULL;
+    return word;
+}
 
-    // validate number and check if it's floating point or not
-    ptr = jsondata->ptr;
-    is_float = False;
+// Sets bits in (at least) every byte of word that isn't an ASCII digit
+// up to and including the first: a digit's high nibble is 3, and so it
+// still is once 6 is added. (A carry out of a byte that isn't a digit
+// can only spoil the bytes after it.)
+#define swar_nondigits(word) \
+    ((((word) & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL) \
+     | ((((word) + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL))
+#endif
 
-    if (*ptr == '-' || *ptr == '+') {
-        ptr++;
-    }
+// Floats whose digits (sans leading zeros) fit in 53 bits, scaled by a power
+// of ten that is itself exact as a double, are converted with a single,
+// correctly rounded multiply or divide (Clinger's fast path). This relies on
+// doubles being evaluated as doubles, which the x87 FPU doesn't do.
+#if defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0)
+#define CHJSON_FAST_FLOAT 1
+#endif
 
-    // Check for number: int, int frac, int exp, or int frac exp.
-    // Start with the first character.
-    if (*ptr == '0') {
-        ptr++;
-        // Hmm. Per JSON spec. it's wrong to have digits after a leading '0'.
-        if (isdigit(*ptr)) {
-            goto number_error;
-        }
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+#define MAX_EXACT_POW10 22
+
+static const double exact_pow10[MAX_EXACT_POW10 + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Numbers that miss the fast path are copied here for PyOS_string_to_double
+// (if they fit; otherwise, the copy is allocated).
+#define FLOAT_BUF_SIZE 64
+
+// Error messages quote (up to) 20 characters of input, UTF-8 encoded.
+#define SNIPPET_CHARS 20
+#define SNIPPET_SIZE (SNIPPET_CHARS * 4 + 1)
+
+static char *
+write_utf8(char *out, Py_UCS4 ch)
+{
+    if (ch < 0x80) {
+        *out++ = (char)ch;
     }
-    else if (isdigit(*ptr)) {
-        skipDigits(ptr);
+    else if (ch < 0x800) {
+        *out++ = (char)(0xC0 | (ch >> 6));
+        *out++ = (char)(0x80 | (ch & 0x3F));
     }
-    // chjson: leading '0' digit not required.
-    else if ((*ptr == '.') && (!jsondata->strict)) {
-        ; // We'll handle this next.
+    else if (ch < 0x10000) {
+        *out++ = (char)(0xE0 | (ch >> 12));
+        *out++ = (char)(0x80 | ((ch >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (ch & 0x3F));
     }
     else {
-        goto number_error;
+        *out++ = (char)(0xF0 | (ch >> 18));
+        *out++ = (char)(0x80 | ((ch >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((ch >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (ch & 0x3F));
     }
+    return out;
+}
 
-    if (*ptr == '.') {
-       is_float = True;
-       ptr++;
-       if (!isdigit(*ptr)) {
-           goto number_error;
-       }
-       skipDigits(ptr);
+// Returns the length of the UTF-8 sequence at ptr (whose first byte isn't
+// ASCII) and sets *ch to its code point, or returns 0 if it's not valid:
+// truncated, overlong, a surrogate, or past U+10FFFF.
+static int
+utf8_decode(const Py_UCS1 *ptr, const Py_UCS1 *end, Py_UCS4 *ch)
+{
+    Py_UCS4 c0 = ptr[0];
+    Py_UCS1 lo = 0x80, hi = 0xBF;
+    int n_bytes, i;
+
+    if ((c0 >= 0xC2) && (c0 <= 0xDF)) {
+        n_bytes = 2;
+        *ch = c0 & 0x1F;
+    }
+    else if ((c0 >= 0xE0) && (c0 <= 0xEF)) {
+        n_bytes = 3;
+        *ch = c0 & 0x0F;
+        if (c0 == 0xE0) {
+            lo = 0xA0;
+        }
+        else if (c0 == 0xED) {
+            hi = 0x9F;
+        }
     }
-
-    if (*ptr == 'e' || *ptr == 'E') {
-       is_float = True;
-       ptr++;
-       if (*ptr == '+' || *ptr == '-') {
-           ptr++;
-       }
-       if (!isdigit(*ptr)) {
-           goto number_error;
-       }
-       skipDigits(ptr);
+    else if ((c0 >= 0xF0) && (c0 <= 0xF4)) {
+        n_bytes = 4;
+        *ch = c0 & 0x07;
+        if (c0 == 0xF0) {
+            lo = 0x90;
+        }
+        else if (c0 == 0xF4) {
+            hi = 0x8F;
+        }
     }
-
-    str = PYUNICODE_FROMSTRINGANDSIZE(jsondata->ptr, ptr - jsondata->ptr);
-    if (str == NULL) {
-        return NULL;
+    else {
+        return 0;
     }
-
-    if (is_float) {
-        #if PY_MAJOR_VERSION >= 3
-            object = PyFloat_FromString(str);
-        #else
-            object = PyFloat_FromString(str, NULL);
-        #endif
+    if (end - ptr < n_bytes) {
+        return 0;
     }
-    else {
-        #if PY_MAJOR_VERSION >= 3
-            object = PyInt_FromString(PyUnicode_AS_UNICODE(str), Py_SIZE(str), 10);
-        #else
-            object = PyInt_FromString(PyBytes_AS_STRING(str), NULL, 10);
-        #endif
+    // Only the second byte's range depends on the first.
+    if ((ptr[1] < lo) || (ptr[1] > hi)) {
+        return 0;
     }
-
-    Py_DECREF(str);
-
-    if (object == NULL) {
-        goto number_error;
+    *ch = (*ch << 6) | (ptr[1] & 0x3F);
+    for (i = 2; i < n_bytes; i++) {
+        if ((ptr[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        *ch = (*ch << 6) | (ptr[i] & 0x3F);
     }
+    return n_bytes;
+}
 
-    //jsondata->ptr = ptr;
-    //jsondata_mv_ptr(jsondata, (Py_ssize_t)(ptr - jsondata->ptr) / sizeof(char *), 0);
-    jsondata_mv_ptr(jsondata, (Py_ssize_t)(ptr - jsondata->ptr), 0);
-
-    return object;
+// Returns the number of characters from ptr to end: the bytes that don't
+// continue a sequence. (Only errors need this, so it needn't be fast.)
+static Py_ssize_t
+utf8_count(const Py_UCS1 *ptr, const Py_UCS1 *end)
+{
+    Py_ssize_t count = 0;
 
-number_error:
-    PyErr_Format(
-        JSON_DecodeError,
-        "invalid number starting at position " SSIZE_T_F
-            " (lineno %ld, offset %ld)",
-        (Py_ssize_t)(jsondata->ptr - jsondata->str),
-        jsondata->lineno, jsondata->offset
-    );
-    return NULL;
+    for (; ptr < end; ptr++) {
+        count += ((*ptr & 0xC0) != 0x80);
+    }
+    return count;
 }
 
-typedef enum {
-    ArrayItem_or_ClosingBracket=0,
-    Comma_or_ClosingBracket,
-    ArrayItem,
-    ArrayDone
-} ArrayState;
-
-static PyObject *
-decode_array(JSONData *jsondata)
-{
-    PyObject *object, *item;
-    ArrayState next_state;
-    int c, result;
-    char *start;
-
-    object = PyList_New(0);
-
-    start = jsondata->ptr;
-    //jsondata->ptr++;
-    jsondata_mv_ptr(jsondata, 1, 0);
-
-    next_state = ArrayItem_or_ClosingBracket;
-
-    while (next_state != ArrayDone) {
-        skip_spaces(jsondata);
-        c = *jsondata->ptr;
-        if (c == 0) {
-            PyErr_Format(
-                JSON_DecodeError,
-                "unterminated array starting at position " SSIZE_T_F
-                    " (lineno %ld, offset %ld)",
-                (Py_ssize_t)(start - jsondata->str),
-                jsondata->lineno, jsondata->offset
-            );
-            goto failure;
+// Validates the run of non-ASCII characters at ptr, adding how many there
+// are to *length and raising *maxchar to the largest. Returns a pointer to
+// the (ASCII) byte after the run, or NULL if a sequence isn't valid.
+static const Py_UCS1 *
+utf8_measure(const Py_UCS1 *ptr, const Py_UCS1 *end, Py_ssize_t *length, Py_UCS4 *maxchar)
+{
+    Py_ssize_t n_chars = 0;
+    Py_UCS4 c0, ch, widest = *maxchar;
+    int n_bytes;
+
+    while ((ptr < end) && ((c0 = *ptr) >= 0x80)) {
+        // The common two- and three-byte sequences are checked inline.
+        if ((c0 >= 0xC2) && (c0 < 0xE0) && (end - ptr >= 2)
+            && ((ptr[1] & 0xC0) == 0x80)
+        ) {
+            ch = ((c0 & 0x1F) << 6) | (ptr[1] & 0x3F);
+            ptr += 2;
         }
-        switch (next_state) {
-        case ArrayItem_or_ClosingBracket:
-            if (c == ']') {
-                //jsondata->ptr++;
-                jsondata_mv_ptr(jsondata, 1, 0);
-                next_state = ArrayDone;
-                break;
+        else if ((c0 >= 0xE1) && (c0 < 0xF0) && (c0 != 0xED) && (end - ptr >= 3)
+            && ((ptr[1] & 0xC0) == 0x80) && ((ptr[2] & 0xC0) == 0x80)
+        ) {
+            ch = ((c0 & 0x0F) << 12) | ((ptr[1] & 0x3F) << 6) | (ptr[2] & 0x3F);
+            ptr += 3;
+        }
+        else {
+            n_bytes = utf8_decode(ptr, end, &ch);
+            if (n_bytes == 0) {
+                return NULL;
             }
-        case ArrayItem:
-            if ((c == ',') || (c == ']')) {
-                PyErr_Format(
-                    JSON_DecodeError,
-                    "expecting array item at position " SSIZE_T_F
-                        " (lineno %ld, offset %ld)",
-                    (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                    jsondata->lineno, jsondata->offset
-                );
-                goto failure;
+            ptr += n_bytes;
+        }
+        if (ch > widest) {
+            widest = ch;
+        }
+        n_chars++;
+    }
+    *length += n_chars;
+    *maxchar = widest;
+    return ptr;
+}
+
+// Decodes the UTF-8 from ptr to end, which has been validated, into the
+// unicode object's data starting at index i, and returns the index after.
+// The input's read again, though, long after it was validated, and a buffer
+// can change in the meantime (an mmap whose file is rewritten, say), so it's
+// never read past end, nor the object written past its length characters,
+// nor with a character too wide for its kind (or maxchar, if that's ASCII).
+// Returns -1 if the UTF-8 isn't what it was. (Short of that, a sequence
+// that's changed since is only checked as far as it needs to be to decode.)
+static Py_ssize_t
+utf8_write(
+    const Py_UCS1 *ptr, const Py_UCS1 *end, int kind, void *data, Py_ssize_t i,
+    Py_ssize_t length, Py_UCS4 maxchar
+) {
+    Py_UCS1 *out1, *out1_end;
+    Py_UCS2 *out2, *out2_end;
+    Py_UCS4 *out4, *out4_end;
+    Py_UCS4 c0, ch;
+    int n_bytes;
+
+    if (kind == PyUnicode_1BYTE_KIND) {
+        // Latin-1: every sequence is ASCII, or two bytes that start C2 or C3.
+        out1 = (Py_UCS1 *)data + i;
+        out1_end = (Py_UCS1 *)data + length;
+        while ((ptr < end) && (out1 < out1_end)) {
+            c0 = *ptr;
+            if (c0 < 0x80) {
+                *out1++ = (Py_UCS1)c0;
+                ptr++;
             }
-            item = decode_json(jsondata);
-            if (item == NULL) {
-                goto failure;
+            else if ((maxchar >= 0x80) && ((c0 == 0xC2) || (c0 == 0xC3)) && (end - ptr >= 2)) {
+                *out1++ = (Py_UCS1)(((c0 & 0x1F) << 6) | (ptr[1] & 0x3F));
+                ptr += 2;
             }
-            result = PyList_Append(object, item);
-            Py_DECREF(item);
-            if (result == -1) {
-                goto failure;
+            else {
+                return -1;
             }
-            next_state = Comma_or_ClosingBracket;
-            break;
-        case Comma_or_ClosingBracket:
-            if (c == ']') {
-                //jsondata->ptr++;
-                jsondata_mv_ptr(jsondata, 1, 0);
-                next_state = ArrayDone;
-            }
-            else if (c == ',') {
-                //jsondata->ptr++;
-                jsondata_mv_ptr(jsondata, 1, 0);
-                if (jsondata->strict) {
-                    next_state = ArrayItem;
-                }
-                else {
-                    // chjson: Allow trailing comma.
-                    next_state = ArrayItem_or_ClosingBracket;
+        }
+        i = out1 - (Py_UCS1 *)data;
+    }
+    else if (kind == PyUnicode_2BYTE_KIND) {
+        // The BMP: sequences of up to three bytes. (Only near the end do
+        // they have to be checked for running past it.)
+        out2 = (Py_UCS2 *)data + i;
+        out2_end = (Py_UCS2 *)data + length;
+        while ((out2 < out2_end) && (ptr < end)) {
+            c0 = *ptr;
+            if (c0 < 0x80) {
+                *out2++ = (Py_UCS2)c0;
+                ptr++;
+                continue;
+            }
+            if (end - ptr < 3) {
+                if ((c0 >= 0xE0) || (end - ptr < 2)) {
+                    return -1;
                 }
             }
+            if (c0 < 0xE0) {
+                *out2++ = (Py_UCS2)(((c0 & 0x1F) << 6) | (ptr[1] & 0x3F));
+                ptr += 2;
+            }
+            else if (c0 < 0xF0) {
+                *out2++ = (Py_UCS2)(((c0 & 0x0F) << 12) | ((ptr[1] & 0x3F) << 6) | (ptr[2] & 0x3F));
+                ptr += 3;
+            }
             else {
-                PyErr_Format(
-                    JSON_DecodeError,
-                    "expecting ',' or ']' at position " SSIZE_T_F
-                        " (lineno %ld, offset %ld)",
-                    (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                    jsondata->lineno, jsondata->offset
-                );
-                goto failure;
+                return -1;
             }
-            break;
-        case ArrayDone:
-            // this will never be reached, but keep compilers happy
-            break;
         }
+        i = out2 - (Py_UCS2 *)data;
     }
+    else {
+        out4 = (Py_UCS4 *)data + i;
+        out4_end = (Py_UCS4 *)data + length;
+        while ((ptr < end) && (out4 < out4_end)) {
+            if (*ptr < 0x80) {
+                *out4++ = *ptr++;
+            }
+            else {
+                n_bytes = utf8_decode(ptr, end, &ch);
+                if (n_bytes == 0) {
+                    return -1;
+                }
+                *out4++ = ch;
+                ptr += n_bytes;
+            }
+        }
+        i = out4 - (Py_UCS4 *)data;
+    }
+    return (ptr < end) ? -1 : i;
+}
 
-    return object;
-
-failure:
-    Py_DECREF(object);
+// What measure_string() learns about a string literal while validating it:
+// all that build_string() needs to materialize it in one allocation.
+typedef struct StringInfo {
+    void *body; // the first character after the opening quote
+    void *close; // the closing quote
+    Py_ssize_t length; // the number of code points once decoded
+    Py_UCS4 maxchar; // the largest decoded code point
+    int has_escapes; // if False, the body is copied verbatim
+} StringInfo;
+
+// Raises the DecodeError for a string that build_string() finds isn't what
+// measure_string() measured: the input changed in between.
+static PyObject *
+string_changed(void)
+{
+    PyErr_SetString(JSON_DecodeError, "input changed while it was being decoded");
     return NULL;
 }
 
+// The smallest code point that would widen a string whose widest
+// character so far is maxchar, i.e., the next PEP 393 kind boundary.
+// (In UTF-8, every non-ASCII byte has to be looked at, to be decoded.)
+#define STRING_STOP_AT(maxchar) \
+    ((((maxchar) < 0x80) || (JSON_UTF8)) ? 0x80 \
+        : ((maxchar) < 0x100) ? 0x100 \
+        : ((maxchar) < 0x10000) ? 0x10000 \
+        : 0x110000)
+
+typedef enum {
+    ArrayItem_or_ClosingBracket=0,
+    Comma_or_ClosingBracket,
+    ArrayItem
+} ArrayState;
+
 typedef enum {
     DictionaryKey_or_ClosingBrace=0,
     Comma_or_ClosingBrace,
-    DictionaryKey,
-    DictionaryDone
+    DictionaryKey
 } DictionaryState;
 
-static PyObject *
-decode_object(JSONData *jsondata)
-{
-    PyObject *object, *key, *value;
-    DictionaryState next_state;
-    int c, result, trailing_comma = False;
-    char *start;
-
-    object = PyDict_New();
-
-    start = jsondata->ptr;
-    //jsondata->ptr++;
-    jsondata_mv_ptr(jsondata, 1, 0);
-
-    next_state = DictionaryKey_or_ClosingBrace;
-
-    while (next_state != DictionaryDone) {
-        skip_spaces(jsondata);
-        c = *jsondata->ptr;
-        if (c == 0) {
-            PyErr_Format(
-                JSON_DecodeError,
-                "unterminated object starting at position " SSIZE_T_F
-                    " (lineno %ld, offset %ld)",
-                (Py_ssize_t)(start - jsondata->str),
-                jsondata->lineno, jsondata->offset
-            );
-            goto failure;
+// An array or object that's being tokenized, or built from the tape.
+typedef struct Frame {
+    int is_object;
+    // While tokenizing.
+    int state; // an ArrayState or a DictionaryState
+    void *start; // the opening bracket or brace
+    int trailing_comma; // (objects only)
+    // While building: where its items start on the scratch stack.
+    Py_ssize_t base;
+    // While building objects.
+    Py_ssize_t n_keys;
+    Shape *shape;
+    int in_shape; // if the keys so far are the shape's
+} Frame;
+
+#define DEFAULT_MAX_DEPTH 1000
+#define FRAMES_MIN_CAPACITY 16
+
+// Returns a new frame on top of the stack (to be filled in by the caller),
+// or NULL if there's no memory. (The caller checks max_depth.) The stack is
+// raw memory, so that it can be used without the GIL.
+static Frame *
+frame_push(FrameStack *stack)
+{
+    Frame *frames;
+    Py_ssize_t capacity;
+
+    if (stack->size == stack->capacity) {
+        capacity = stack->capacity * 2;
+        if (capacity < FRAMES_MIN_CAPACITY) {
+            capacity = FRAMES_MIN_CAPACITY;
+        }
+        frames = PyMem_RawRealloc(stack->frames, capacity * sizeof(Frame));
+        if (frames == NULL) {
+            return NULL;
         }
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+    return &stack->frames[stack->size++];
+}
 
-        switch (next_state) {
-        case DictionaryKey_or_ClosingBrace:
-            if (c == '}') {
-                trailing_comma = False;
-                //jsondata->ptr++;
-                jsondata_mv_ptr(jsondata, 1, 0);
-                next_state = DictionaryDone;
-                break;
-            }
-        case DictionaryKey:
-            // OC:
-            //  if (c != '"') {
-            // chjson loose quotes:
-            if ((c != '"') && ((jsondata->strict) || (c != '\''))) {
-                // MAYBE: Make a real Python exception type class. 
-                // For now, when you catch the exception in Python, the dict is parts of
-                // args, e.g., catch JSON_DecodeError as e can be accessed e.args[0]['offset'].
-                /*
-                PyObject *d = PyDict_New();
-                PyDict_SetItemString(d, "lineno", PyLong_FromLong(jsondata->lineno));
-                PyDict_SetItemString(d, "offset", PyLong_FromLong(jsondata->offset));
-                PyDict_SetItemString(d, "anything", PyLong_FromLong(jsondata->offset));
-                PyDict_SetItemString(d, "message", PyLong_FromLong(jsondata->offset));
-                PyErr_SetObject(JSON_DecodeError, d);
-                Py_DECREF(d);
-                goto failure;
-                */
-                if (trailing_comma) {
-                    PyErr_Format(
-                        JSON_DecodeError,
-                        "expecting object property name rather than trailing comma "
-                        "at position " SSIZE_T_F " (lineno %ld, offset %ld)",
-                        (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                        jsondata->lineno, jsondata->offset
-                    );
-                }
-                else {
-                    PyErr_Format(
-                        JSON_DecodeError,
-                        "expecting object property name at position "
-                            SSIZE_T_F " (lineno %ld, offset %ld)",
-                        (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                        jsondata->lineno, jsondata->offset
-                    );
-                }
-                goto failure;
-            }
-            trailing_comma = False;
+// Decoding is done in two phases. First, the input is validated and
+// tokenized onto a tape, one entry per value (plus one for each key, and
+// one at the end of each array and object), without any Python objects,
+// so that it can be done with the GIL released. Then the values are built
+// from the tape, which doesn't have to look at the grammar again. (If no
+// other thread could use the GIL, the two are interleaved instead, a few
+// thousand entries at a time.)
+typedef enum {
+    TAPE_NULL=0,
+    TAPE_TRUE,
+    TAPE_FALSE,
+    TAPE_INTEGER, // one that fits in a long long
+    TAPE_FLOAT, // one that could be converted without Python's strtod
+    TAPE_NUMBER, // any other number, to be converted from its text
+    TAPE_STRING,
+    TAPE_KEY, // an object key, which is a string, too
+    TAPE_ARRAY,
+    TAPE_OBJECT,
+    TAPE_END_ARRAY,
+    TAPE_END_OBJECT
+} TapeType;
+
+// Positions are offsets (in code units) from the start of the input.
+typedef struct TapeEntry {
+    unsigned char type; // a TapeType
+    unsigned char has_escapes; // strings (see StringInfo)
+    Py_UCS4 maxchar; // strings
+    Py_ssize_t start; // where the value starts, or the body, for strings
+    union {
+        struct {
+            Py_ssize_t close; // the closing quote
+            Py_ssize_t length;
+        } string;
+        long long integer;
+        double real;
+        struct {
+            // Where the number is, for the error, if it can't be converted.
+            Py_ssize_t line_start;
+            long lineno;
+        } number;
+    } u;
+} TapeEntry;
+
+#define TAPE_MIN_CAPACITY 64
+#define TAPE_CHUNK 2048
+
+// Doubles the tape's capacity, for tape_push(). Returns -1 if there's no
+// memory.
+static int
+tape_grow(JSONData *jsondata)
+{
+    TapeEntry *tape;
+    Py_ssize_t capacity;
 
-            key = decode_json(jsondata);
-            if (key == NULL) {
-                goto failure;
-            }
+    capacity = jsondata->tape_capacity * 2;
+    if (capacity < TAPE_MIN_CAPACITY) {
+        capacity = TAPE_MIN_CAPACITY;
+    }
+    tape = PyMem_RawRealloc(jsondata->tape, capacity * sizeof(TapeEntry));
+    if (tape == NULL) {
+        return -1;
+    }
+    jsondata->tape = tape;
+    jsondata->tape_capacity = capacity;
+    return 0;
+}
 
-            skip_spaces(jsondata);
-            if (*jsondata->ptr != ':') {
-                PyErr_Format(
-                    JSON_DecodeError,
-                    "missing colon after object property name at position " SSIZE_T_F
-                        " (lineno %ld, offset %ld)",
-                    (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                    jsondata->lineno, jsondata->offset
-                );
-                Py_DECREF(key);
-                goto failure;
-            }
-            else {
-                //jsondata->ptr++;
-                jsondata_mv_ptr(jsondata, 1, 0);
-            }
-
-            skip_spaces(jsondata);
-            if ((*jsondata->ptr == ',') || (*jsondata->ptr == '}')) {
-                PyErr_Format(
-                    JSON_DecodeError,
-                    "expecting object property value at position " SSIZE_T_F
-                        " (lineno %ld, offset %ld)",
-                    (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                    jsondata->lineno, jsondata->offset
-                );
-                Py_DECREF(key);
-                goto failure;
-            }
+// Returns a new entry at the end of the tape (to be filled in by the
+// caller), or NULL if there's no memory. Doesn't need the GIL.
+Py_LOCAL_INLINE(TapeEntry *)
+tape_push(JSONData *jsondata)
+{
+    if ((jsondata->tape_size == jsondata->tape_capacity) && (tape_grow(jsondata) == -1)) {
+        return NULL;
+    }
+    return &jsondata->tape[jsondata->tape_size++];
+}
 
-            value = decode_json(jsondata);
-            if (value == NULL) {
-                Py_DECREF(key);
-                goto failure;
-            }
+// Why tokenizing failed. Each is raised as a DecodeError (see raise_error
+// in chjson_decode.h), except Error_NoMemory, which is a MemoryError.
+typedef enum {
+    Error_None=0,
+    Error_NoMemory,
+    Error_Null,
+    Error_Bool,
+    Error_Inf,
+    Error_NaN,
+    Error_Number,
+    Error_Escape,
+    Error_TruncatedEscape,
+    Error_UnterminatedString,
+    Error_StringNewline,
+    Error_InvalidUTF8,
+    Error_Empty,
+    Error_Token,
+    Error_Nul,
+    Error_MaxDepth,
+    Error_UnterminatedArray,
+    Error_UnterminatedObject,
+    Error_ArrayItem,
+    Error_ArrayComma,
+    Error_PropertyName,
+    Error_PropertyNameAfterComma,
+    Error_Colon,
+    Error_PropertyValue,
+    Error_ObjectComma,
+    Error_ExtraData
+} DecodeErrorCode;
+
+// Records why tokenizing stopped, and where (to raise later, with the GIL).
+// Returns -1, for the caller to return.
+static int
+jsondata_fail(JSONData *jsondata, int error, void *at)
+{
+    jsondata->error = error;
+    jsondata->error_at = at;
+    return -1;
+}
 
-            result = PyDict_SetItem(object, key, value);
-            Py_DECREF(key);
-            Py_DECREF(value);
-            if (result == -1) {
-                goto failure;
-            }
-            next_state = Comma_or_ClosingBrace;
-            break;
-        case Comma_or_ClosingBrace:
-            trailing_comma = False;
-            if (c == '}') {
-                //jsondata->ptr++;
-                jsondata_mv_ptr(jsondata, 1, 0);
-                next_state = DictionaryDone;
-            }
-            else if (c == ',') {
-                //jsondata->ptr++;
-                jsondata_mv_ptr(jsondata, 1, 0);
-                if (jsondata->strict) {
-                    next_state = DictionaryKey;
-                }
-                else {
-                    // chjson: Allow trailing comma.
-                    next_state = DictionaryKey_or_ClosingBrace;
-                }
-                trailing_comma = True;
-            }
-            else {
-                PyErr_Format(
-                    JSON_DecodeError,
-                    "expecting ',' or '}' at position " SSIZE_T_F
-                        " (lineno %ld, offset %ld)",
-                    (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                    jsondata->lineno, jsondata->offset
-                );
-                goto failure;
-            }
-            break;
-        case DictionaryDone:
-            trailing_comma = False;
-            // this will never be reached, but keep compilers happy
-            break;
+static void
+decoder_cache_init(DecoderCache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void
+decoder_cache_clear(DecoderCache *cache)
+{
+    int i;
+
+    for (i = 0; i < KEY_CACHE_SIZE; i++) {
+        Py_CLEAR(cache->keys.keys[i]);
+    }
+    for (i = 0; i < SHAPE_MAX_DEPTH; i++) {
+        Py_CLEAR(cache->shapes[i].keys);
+        Py_CLEAR(cache->shapes[i].dict);
+        cache->shapes[i].misses = 0;
+    }
+}
+
+// decode() keeps its cache from one call to the next. (A call that starts
+// while another is still using it, say, from a finalizer that runs during
+// a garbage collection, gets a cache of its own.)
+static DecoderCache default_cache;
+
+#define SCRATCH_MIN_CAPACITY 64
+
+// Pushes item onto the scratch stack, which takes over the reference
+// (and drops it, if the stack can't grow).
+static int
+scratch_push(JSONData *jsondata, PyObject *item)
+{
+    PyObject **scratch;
+    Py_ssize_t capacity;
+
+    if (jsondata->scratch_size == jsondata->scratch_capacity) {
+        capacity = jsondata->scratch_capacity * 2;
+        if (capacity < SCRATCH_MIN_CAPACITY) {
+            capacity = SCRATCH_MIN_CAPACITY;
         }
+        scratch = PyMem_Resize(jsondata->scratch, PyObject *, capacity);
+        if (scratch == NULL) {
+            Py_DECREF(item);
+            PyErr_NoMemory();
+            return -1;
+        }
+        jsondata->scratch = scratch;
+        jsondata->scratch_capacity = capacity;
     }
+    jsondata->scratch[jsondata->scratch_size++] = item;
+    return 0;
+}
 
-    return object;
+// Moves the items pushed since the stack was base high into a new list.
+static PyObject *
+scratch_pop_list(JSONData *jsondata, Py_ssize_t base)
+{
+    PyObject *list;
+    Py_ssize_t i, n = jsondata->scratch_size - base;
+
+    list = PyList_New(n);
+    if (list == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        PyList_SET_ITEM(list, i, jsondata->scratch[base + i]);
+    }
+    jsondata->scratch_size = base;
+    return list;
+}
+
+// Drops the items pushed since the stack was base high.
+static void
+scratch_discard(JSONData *jsondata, Py_ssize_t base)
+{
+    while (jsondata->scratch_size > base) {
+        jsondata->scratch_size--;
+        Py_DECREF(jsondata->scratch[jsondata->scratch_size]);
+    }
+}
+
+// Makes the n keys in pairs (which alternate keys and values) the shape's.
+static int
+shape_set(Shape *shape, PyObject **pairs, Py_ssize_t n)
+{
+    PyObject *keys, *dict;
+    Py_ssize_t i;
+
+    keys = PyTuple_New(n);
+    dict = PyDict_New();
+    if ((keys == NULL) || (dict == NULL)) {
+        goto failure;
+    }
+    for (i = 0; i < n; i++) {
+        Py_INCREF(pairs[2 * i]);
+        PyTuple_SET_ITEM(keys, i, pairs[2 * i]);
+        if (PyDict_SetItem(dict, pairs[2 * i], Py_None) == -1) {
+            goto failure;
+        }
+    }
+    Py_XSETREF(shape->keys, keys);
+    Py_XSETREF(shape->dict, dict);
+    shape->misses = 0;
+    return 0;
 
 failure:
-    Py_DECREF(object);
-    return NULL;
+    Py_XDECREF(keys);
+    Py_XDECREF(dict);
+    return -1;
 }
 
+// Moves the key-value pairs pushed since the stack was base high into a new
+// dict. If in_shape, the keys are the shape's keys, in order (so far).
 static PyObject *
-decode_json(JSONData *jsondata)
+scratch_pop_dict(JSONData *jsondata, Py_ssize_t base, Shape *shape, int in_shape)
 {
-    PyObject *object;
-
-    skip_spaces(jsondata);
+    PyObject *dict;
+    PyObject **pairs = jsondata->scratch + base;
+    Py_ssize_t i, n = (jsondata->scratch_size - base) / 2;
 
-    if (
-        (*jsondata->ptr == '"')
-        // chjson loose quotes: single-quoted strings OK
-        || ((*jsondata->ptr == '\'') && (!jsondata->strict))
-    ) {
-        object = decode_string(jsondata);
+    in_shape = in_shape && (shape != NULL) && (shape->keys != NULL)
+        && (PyTuple_GET_SIZE(shape->keys) == n);
+    if (in_shape) {
+        dict = PyDict_Copy(shape->dict);
+        shape->misses = 0;
     }
     else {
-        switch(*jsondata->ptr) {
-        case 0:
-            PyErr_Format(
-                JSON_DecodeError,
-                "empty JSON description (lineno %ld, offset %ld)",
-                jsondata->lineno, jsondata->offset
-            );
+        dict = PyDict_New();
+    }
+    if (dict == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        if (PyDict_SetItem(dict, pairs[2 * i], pairs[2 * i + 1]) == -1) {
+            Py_DECREF(dict);
             return NULL;
-        case '{':
-            object = decode_object(jsondata);
-            break;
-        case '[':
-            object = decode_array(jsondata);
-            break;
-        case 't':
-        case 'f':
-            object = decode_bool(jsondata);
-            break;
-        case 'n':
-            object = decode_null(jsondata);
-            break;
-        case 'N':
-            object = decode_nan(jsondata);
-            break;
-        case 'I':
-            object = decode_inf(jsondata);
-            break;
-        case '+':
-        case '-':
-            if (*(jsondata->ptr+1) == 'I') {
-                object = decode_inf(jsondata);
-                break;
-            }
-            // fall through
-        case '.':
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-            object = decode_number(jsondata);
-            break;
-        default:
-            PyErr_Format(
-                JSON_DecodeError,
-                "cannot parse JSON description as token: \"%c\""
-                    " (lineno %ld, offset %ld)",
-                *(jsondata->ptr), jsondata->lineno, jsondata->offset
-            );
+        }
+    }
+
+    if ((shape != NULL) && (!in_shape) && (n > 0) && (n <= SHAPE_MAX_KEYS)
+        && ((shape->keys == NULL) || (++shape->misses >= SHAPE_MAX_MISSES))
+    ) {
+        if (shape_set(shape, pairs, n) == -1) {
+            Py_DECREF(dict);
             return NULL;
         }
     }
 
-    return object;
+    scratch_discard(jsondata, base);
+    return dict;
+}
+
+// A decoder variant's entry points (see chjson_decode.h).
+typedef struct DecoderVariant {
+    // Phase 1 (without the GIL, if need be): each returns 0 when done, 1 if
+    // it paused (see tape_limit), or -1 with jsondata->error set.
+    int (*tokenize_value)(JSONData *jsondata);
+    int (*tokenize_document)(JSONData *jsondata);
+    // Skips whitespace (and comments), returning the code unit after it.
+    Py_UCS4 (*skip_spaces)(JSONData *jsondata);
+    // Raises the error that tokenizing stopped with.
+    void (*raise_error)(JSONData *jsondata);
+    // Phase 2: returns 1 with the value built, 0 if it's not all on the
+    // tape yet, or -1 with an exception set.
+    int (*build_value)(JSONData *jsondata, PyObject **value);
+    // Returns True if the key on the tape is the str key (see iter_path()).
+    int (*match_key)(JSONData *jsondata, TapeEntry *entry, PyObject *key);
+    // Builds the key on the tape (see parse_events()).
+    PyObject *(*build_key)(JSONData *jsondata, TapeEntry *entry);
+} DecoderVariant;
+
+#define JSON_KIND 1
+#define JSON_CHAR Py_UCS1
+#define JSON_KIND_FN(name) name##_ucs1
+#define JSON_UTF8 0
+#define JSON_STRICT 0
+#define JSON_FN(name) name##_ucs1_loose
+#include "chjson_decode.h"
+
+#define JSON_KIND 1
+#define JSON_CHAR Py_UCS1
+#define JSON_KIND_FN(name) name##_ucs1
+#define JSON_UTF8 0
+#define JSON_STRICT 1
+#define JSON_FN(name) name##_ucs1_strict
+#include "chjson_decode.h"
+
+#define JSON_KIND 1
+#define JSON_CHAR Py_UCS1
+#define JSON_KIND_FN(name) name##_ucs1
+#define JSON_UTF8 1
+#define JSON_STRICT 0
+#define JSON_FN(name) name##_utf8_loose
+#include "chjson_decode.h"
+
+#define JSON_KIND 1
+#define JSON_CHAR Py_UCS1
+#define JSON_KIND_FN(name) name##_ucs1
+#define JSON_UTF8 1
+#define JSON_STRICT 1
+#define JSON_FN(name) name##_utf8_strict
+#include "chjson_decode.h"
+
+#define JSON_KIND 2
+#define JSON_CHAR Py_UCS2
+#define JSON_KIND_FN(name) name##_ucs2
+#define JSON_UTF8 0
+#define JSON_STRICT 0
+#define JSON_FN(name) name##_ucs2_loose
+#include "chjson_decode.h"
+
+#define JSON_KIND 2
+#define JSON_CHAR Py_UCS2
+#define JSON_KIND_FN(name) name##_ucs2
+#define JSON_UTF8 0
+#define JSON_STRICT 1
+#define JSON_FN(name) name##_ucs2_strict
+#include "chjson_decode.h"
+
+#define JSON_KIND 4
+#define JSON_CHAR Py_UCS4
+#define JSON_KIND_FN(name) name##_ucs4
+#define JSON_UTF8 0
+#define JSON_STRICT 0
+#define JSON_FN(name) name##_ucs4_loose
+#include "chjson_decode.h"
+
+#define JSON_KIND 4
+#define JSON_CHAR Py_UCS4
+#define JSON_KIND_FN(name) name##_ucs4
+#define JSON_UTF8 0
+#define JSON_STRICT 1
+#define JSON_FN(name) name##_ucs4_strict
+#include "chjson_decode.h"
+
+// Picks the decoder for input of the given kind (or UTF-8) and mode.
+static const DecoderVariant *
+decoder_variant(int kind, int is_utf8, int strict)
+{
+    if (is_utf8) {
+        return (strict) ? &variant_utf8_strict : &variant_utf8_loose;
+    }
+    else if (kind == PyUnicode_1BYTE_KIND) {
+        return (strict) ? &variant_ucs1_strict : &variant_ucs1_loose;
+    }
+    else if (kind == PyUnicode_2BYTE_KIND) {
+        return (strict) ? &variant_ucs2_strict : &variant_ucs2_loose;
+    }
+    return (strict) ? &variant_ucs4_strict : &variant_ucs4_loose;
+}
+
+// Inputs at least this big (in bytes) are tokenized with the GIL released,
+// if there's another thread to use it. (For smaller ones, it's not worth
+// possibly having to wait to get it back.)
+#define NOGIL_MIN_SIZE (64 * 1024)
+
+// Returns True if there's a thread (other than this one) that could run
+// while the GIL's released.
+static int
+other_threads_exist(void)
+{
+    PyInterpreterState *interp;
+
+    #if PY_VERSION_HEX >= 0x03090000
+    interp = PyInterpreterState_Get();
+    #else
+    interp = PyThreadState_GET()->interp;
+    #endif
+    return PyThreadState_Next(PyInterpreterState_ThreadHead(interp)) != NULL;
+}
+
+// Most documents are small, so rather than allocating a tape for each one,
+// the last (small enough) tape is kept for the next. (Only while holding the
+// GIL, which guards it.)
+#define SPARE_TAPE_MAX_CAPACITY 4096
+static TapeEntry *spare_tape;
+static Py_ssize_t spare_tape_capacity;
+
+// Readies jsondata to tokenize the length code units of the given kind at
+// str. Needs the GIL.
+static void
+jsondata_init(JSONData *jsondata, void *str, Py_ssize_t length, int kind, Py_ssize_t max_depth)
+{
+    memset(jsondata, 0, sizeof(*jsondata));
+    jsondata->str = str;
+    jsondata->ptr = str;
+    jsondata->end = (char *)str + length * kind;
+    jsondata->lineno = 1;
+    jsondata->line_start = str;
+    jsondata->max_depth = max_depth;
+    jsondata->tape = spare_tape;
+    jsondata->tape_capacity = spare_tape_capacity;
+    jsondata->tape_limit = PY_SSIZE_T_MAX;
+    spare_tape = NULL;
+    spare_tape_capacity = 0;
+}
+
+// Needs the GIL. (Can be called again, which does nothing.)
+static void
+jsondata_free(JSONData *jsondata)
+{
+    scratch_discard(jsondata, 0);
+    PyMem_Free(jsondata->scratch);
+    PyMem_RawFree(jsondata->tokenizing.frames);
+    PyMem_RawFree(jsondata->building.frames);
+    if ((jsondata->tape != NULL) && (spare_tape == NULL)
+        && (jsondata->tape_capacity <= SPARE_TAPE_MAX_CAPACITY)
+    ) {
+        spare_tape = jsondata->tape;
+        spare_tape_capacity = jsondata->tape_capacity;
+    }
+    else {
+        PyMem_RawFree(jsondata->tape);
+    }
+    jsondata->scratch = NULL;
+    jsondata->scratch_capacity = 0;
+    jsondata->tokenizing.frames = NULL;
+    jsondata->tokenizing.capacity = 0;
+    jsondata->building.frames = NULL;
+    jsondata->building.capacity = 0;
+    jsondata->tape = NULL;
+    jsondata->tape_capacity = 0;
+}
+
+// Picks the cache to build with: the default one, unless it's in use (by a
+// decode() that started this one, say, from a finalizer that ran during a
+// garbage collection), in which case, local_cache.
+static void
+jsondata_claim_cache(JSONData *jsondata, DecoderCache *local_cache)
+{
+    if (!default_cache.in_use) {
+        jsondata->cache = &default_cache;
+    }
+    else {
+        decoder_cache_init(local_cache);
+        jsondata->cache = local_cache;
+    }
+    jsondata->cache->in_use = True;
+}
+
+static void
+jsondata_release_cache(JSONData *jsondata, DecoderCache *local_cache)
+{
+    if (jsondata->cache == local_cache) {
+        decoder_cache_clear(local_cache);
+    }
+    jsondata->cache->in_use = False;
+    jsondata->cache = NULL;
 }
 
 // *** Encoding
@@ -3139,77 +3648,2578 @@ JSON_encode(PyObject *self, PyObject *object)
     return encode_object(object);
 }
 
-// Decode JSON representation into python objects
-static PyObject *
-JSON_decode(PyObject *self, PyObject *args, PyObject *kwargs)
+// Tokenizes the document (or value, with variant->tokenize_value, say),
+// without the GIL if it's big (unless it's mutable, if it could change
+// before the tape is built from it), or else (starts to) a chunk at a time.
+// Returns the status (see DecoderVariant).
+static int
+jsondata_tokenize(JSONData *jsondata, int (*tokenize)(JSONData *), int is_mutable)
 {
-    static char *kwlist[] = {"json", "all_unicode", "strict", NULL};
-    int all_unicode = False; // by default return unicode only when needed
-    int strict = False; // By default, parser is loose.
-    PyObject *object, *string, *str;
-    JSONData jsondata;
+    int status;
 
-    if (!PyArg_ParseTupleAndKeywords(
-        args, kwargs, "O|ii:decode", kwlist, &string, &all_unicode, &strict)
+    if ((!is_mutable)
+        && ((char *)jsondata->end - (char *)jsondata->str >= NOGIL_MIN_SIZE)
+        && other_threads_exist()
     ) {
-        return NULL;
-    }
-
-    if (PyUnicode_Check(string)) {
-        str = PyUnicode_AsRawUnicodeEscapeString(string);
-        if (str == NULL) {
-            return NULL;
-        }
+        Py_BEGIN_ALLOW_THREADS
+        status = tokenize(jsondata);
+        Py_END_ALLOW_THREADS
     }
     else {
-        Py_INCREF(string);
-        str = string;
-    }
-
-    if (PyBytes_AsStringAndSize(str, &(jsondata.str), NULL) == -1) {
-        Py_DECREF(str);
-        return NULL; // not a string object or it contains null bytes
+        jsondata->tape_limit = TAPE_CHUNK;
+        status = tokenize(jsondata);
     }
+    return status;
+}
 
-    #if PY_MAJOR_VERSION >= 3
-    //Py_ssize_t str_size = PyUnicode_GET_SIZE(str);
-    Py_ssize_t str_size = Py_SIZE(str);
-    #else
-    Py_ssize_t str_size = PyString_GET_SIZE(str);
-    #endif
-    jsondata.ptr = jsondata.str;
-    jsondata.end = jsondata.str + str_size;
-    jsondata.all_unicode = all_unicode;
-    jsondata.strict = strict;
-    jsondata.lineno = 1;
-    jsondata.offset = 0;
-
-    object = decode_json(&jsondata);
+// Builds the value that's been tokenized (with the given status, see
+// DecoderVariant), or raises the error that tokenizing stopped with. If
+// tokenizing paused, it's resumed (with the GIL) whenever the tape's used up.
+static PyObject *
+jsondata_build(
+    JSONData *jsondata, const DecoderVariant *variant, int (*tokenize)(JSONData *), int status
+) {
+    PyObject *object = NULL;
+    DecoderCache local_cache;
 
-    if (object != NULL) {
-        skip_spaces(&jsondata);
-        if (jsondata.ptr < jsondata.end) {
-            PyErr_Format(
-                JSON_DecodeError,
-                "extra data after JSON description at position " SSIZE_T_F
-                    " (lineno %ld, offset %ld)",
-                (Py_ssize_t)(jsondata.ptr - jsondata.str),
-                jsondata.lineno, jsondata.offset
-            );
-            Py_DECREF(str);
-            Py_DECREF(object);
-            return NULL;
+    jsondata_claim_cache(jsondata, &local_cache);
+    while (True) {
+        if (status == -1) {
+            variant->raise_error(jsondata);
+            break;
         }
+        if ((variant->build_value(jsondata, &object) != 0) || (status == 0)) {
+            break;
+        }
+        // Tokenizing paused, and the tape's been built: reuse it.
+        jsondata->tape_size = 0;
+        jsondata->tape_read = 0;
+        status = tokenize(jsondata);
     }
+    jsondata_release_cache(jsondata, &local_cache);
+
+    return object;
+}
+
+// Decodes the document in the length code units at str, which are a str's
+// data (of the given kind) or, if is_utf8, UTF-8 bytes.
+static PyObject *
+decode_buffer(
+    void *str, Py_ssize_t length, int kind, int is_utf8, int is_mutable,
+    int strict, Py_ssize_t max_depth
+) {
+    PyObject *object;
+    JSONData jsondata;
+    const DecoderVariant *variant = decoder_variant(kind, is_utf8, strict);
+    int status;
 
-    Py_DECREF(str);
+    jsondata_init(&jsondata, str, length, kind, max_depth);
+    status = jsondata_tokenize(&jsondata, variant->tokenize_document, is_mutable);
+    object = jsondata_build(&jsondata, variant, variant->tokenize_document, status);
+    jsondata_free(&jsondata);
 
     return object;
 }
 
-static PyMethodDef chjson_methods[] = {
-    {
-        "encode",
+// A JSON representation to parse in place: a str's data, whatever its
+// width, or else (bytes, or a bytearray, memoryview, mmap, or anything
+// else with a contiguous buffer) UTF-8. Holding the buffer stops its owner
+// from resizing it until we're done (but not from writing to it, if it's
+// writable, while the GIL's released).
+typedef struct Source {
+    Py_buffer view; // unless it's a str (in which case view.obj is NULL)
+    void *str;
+    Py_ssize_t length; // in code units
+    int kind;
+    int is_utf8;
+    int is_mutable;
+} Source;
+
+static int
+source_open(Source *source, PyObject *json)
+{
+    source->view.obj = NULL;
+    if (PyUnicode_Check(json)) {
+        if (PyUnicode_READY(json) == -1) {
+            return -1;
+        }
+        source->str = PyUnicode_DATA(json);
+        source->length = PyUnicode_GET_LENGTH(json);
+        source->kind = PyUnicode_KIND(json);
+        source->is_utf8 = False;
+        source->is_mutable = False;
+        return 0;
+    }
+    if (PyObject_GetBuffer(json, &source->view, PyBUF_SIMPLE) == -1) {
+        source->view.obj = NULL;
+        return -1;
+    }
+    source->str = source->view.buf;
+    source->length = source->view.len;
+    source->kind = PyUnicode_1BYTE_KIND;
+    source->is_utf8 = True;
+    source->is_mutable = !source->view.readonly;
+    return 0;
+}
+
+static void
+source_close(Source *source)
+{
+    if (source->view.obj != NULL) {
+        PyBuffer_Release(&source->view);
+    }
+}
+
+// A writable buffer is parsed from a copy by callers that run Python code
+// (which could write to it) between tokenizing and building. json, which the
+// caller holds a reference to, is replaced by the copy.
+static int
+source_freeze(Source *source, PyObject **json)
+{
+    PyObject *copy;
+
+    if (!source->is_mutable) {
+        return 0;
+    }
+    copy = PyBytes_FromStringAndSize(source->str, source->length);
+    if (copy == NULL) {
+        return -1;
+    }
+    source_close(source);
+    Py_DECREF(*json);
+    *json = copy;
+    return source_open(source, copy);
+}
+
+// Decode JSON representation into python objects
+static PyObject *
+JSON_decode(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "all_unicode", "strict", "max_depth", NULL};
+    int all_unicode = False; // by default return unicode only when needed
+    int strict = False; // By default, parser is loose.
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH; // arrays and objects, nested
+    PyObject *object, *string;
+    Source source;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|iin:decode", kwlist, &string, &all_unicode, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+
+    if (source_open(&source, string) == -1) {
+        return NULL;
+    }
+    object = decode_buffer(
+        source.str, source.length, source.kind, source.is_utf8, source.is_mutable,
+        strict, max_depth
+    );
+    source_close(&source);
+
+    return object;
+}
+
+// The smallest limit (other than none) that sys.set_int_max_str_digits()
+// takes, on the number of digits that int() converts.
+#define INT_MAX_STR_DIGITS_THRESHOLD 640
+
+// Returns the number of digits that int() converts, as decode() does
+// integers (PY_SSIZE_T_MAX if there's no limit), or -1 with an exception set.
+static Py_ssize_t
+int_max_str_digits(void)
+{
+    PyObject *get, *result;
+    Py_ssize_t limit;
+
+    // (Only Pythons since 3.11, and some security releases before it, have
+    // a limit.)
+    get = PySys_GetObject("get_int_max_str_digits");
+    if (get == NULL) {
+        return PY_SSIZE_T_MAX;
+    }
+    result = PyObject_CallObject(get, NULL);
+    if (result == NULL) {
+        return -1;
+    }
+    limit = PyLong_AsSsize_t(result);
+    Py_DECREF(result);
+    if ((limit == -1) && PyErr_Occurred()) {
+        return -1;
+    }
+    return (limit == 0) ? PY_SSIZE_T_MAX : limit;
+}
+
+// Tokenizes the whole document, a tape at a time, reusing the tape each time
+// it fills up, as if it had been built. Doesn't need the GIL. Returns 0, or
+// -1 with jsondata->error set.
+static int
+validate_buffer(
+    JSONData *jsondata, const DecoderVariant *variant, Py_ssize_t max_int_digits
+) {
+    int status;
+
+    jsondata->tape_limit = TAPE_CHUNK;
+    jsondata->is_validating = True;
+    jsondata->max_int_digits = max_int_digits;
+    do {
+        jsondata->tape_size = 0;
+        status = variant->tokenize_document(jsondata);
+    } while (status == 1);
+    return status;
+}
+
+// Check that a JSON representation parses, without decoding it
+static PyObject *
+JSON_validate(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "strict", "max_depth", NULL};
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *string;
+    Source source;
+    JSONData jsondata;
+    const DecoderVariant *variant;
+    Py_ssize_t max_int_digits;
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|in:validate", kwlist, &string, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+
+    if (source_open(&source, string) == -1) {
+        return NULL;
+    }
+    variant = decoder_variant(source.kind, source.is_utf8, strict);
+    // Integers are held to the smallest limit that Python's int() can have
+    // first, so that the limit's only looked up (with the GIL) for the rare
+    // document that has a longer one, which is then checked again.
+    max_int_digits = INT_MAX_STR_DIGITS_THRESHOLD;
+    for (;;) {
+        jsondata_init(
+            &jsondata, source.str, source.length, source.kind, max_depth);
+        // (As for jsondata_tokenize(), but nothing's built afterwards, so the
+        // GIL's released for a small document, too, if anyone can use it.)
+        if ((!source.is_mutable) && other_threads_exist()) {
+            Py_BEGIN_ALLOW_THREADS
+            status = validate_buffer(&jsondata, variant, max_int_digits);
+            Py_END_ALLOW_THREADS
+        }
+        else {
+            status = validate_buffer(&jsondata, variant, max_int_digits);
+        }
+        if (
+            (status == 0)
+            || (jsondata.error != Error_Number)
+            || (max_int_digits != INT_MAX_STR_DIGITS_THRESHOLD)
+        ) {
+            break;
+        }
+        max_int_digits = int_max_str_digits();
+        if (max_int_digits == -1) {
+            jsondata_free(&jsondata);
+            source_close(&source);
+            return NULL;
+        }
+        if (max_int_digits == INT_MAX_STR_DIGITS_THRESHOLD) {
+            break;
+        }
+        jsondata_free(&jsondata);
+    }
+    if (status == -1) {
+        variant->raise_error(&jsondata);
+    }
+    jsondata_free(&jsondata);
+    source_close(&source);
+
+    if (status == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// Decode the first JSON value in the representation, and say where it ends
+static PyObject *
+JSON_raw_decode(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "strict", "max_depth", NULL};
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *object, *string, *result = NULL;
+    Source source;
+    JSONData jsondata;
+    const DecoderVariant *variant;
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|in:raw_decode", kwlist, &string, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+
+    if (source_open(&source, string) == -1) {
+        return NULL;
+    }
+    variant = decoder_variant(source.kind, source.is_utf8, strict);
+    jsondata_init(&jsondata, source.str, source.length, source.kind, max_depth);
+    status = jsondata_tokenize(&jsondata, variant->tokenize_value, source.is_mutable);
+    object = jsondata_build(&jsondata, variant, variant->tokenize_value, status);
+    if (object != NULL) {
+        // (In code units: characters of a str, or bytes of a buffer.)
+        result = Py_BuildValue(
+            "(Nn)", object,
+            (Py_ssize_t)(((char *)jsondata.ptr - (char *)jsondata.str) / source.kind)
+        );
+    }
+    jsondata_free(&jsondata);
+    source_close(&source);
+
+    return result;
+}
+
+// *** Files
+
+// A file's contents, mapped into memory if possible, or else read into a
+// buffer. Either way, opening and reading (or faulting in) the file doesn't
+// need the GIL.
+typedef struct FileData {
+    void *data;
+    Py_ssize_t length;
+    int is_mapped; // if not, data is from PyMem_RawMalloc
+} FileData;
+
+#define FILE_READ_CHUNK (64 * 1024)
+
+// Reads the rest of fileobj into file->data. Returns 0, or an errno value.
+static int
+file_data_read(FILE *fileobj, FileData *file)
+{
+    char *data = NULL, *grown;
+    size_t length = 0, capacity = 0, n_read;
+
+    while (True) {
+        if (capacity - length < FILE_READ_CHUNK) {
+            capacity = (capacity == 0) ? FILE_READ_CHUNK : capacity * 2;
+            grown = PyMem_RawRealloc(data, capacity);
+            if (grown == NULL) {
+                PyMem_RawFree(data);
+                return ENOMEM;
+            }
+            data = grown;
+        }
+        n_read = fread(data + length, 1, capacity - length, fileobj);
+        length += n_read;
+        if (n_read == 0) {
+            break;
+        }
+    }
+    if (ferror(fileobj)) {
+        PyMem_RawFree(data);
+        return EIO;
+    }
+    file->data = data;
+    file->length = (Py_ssize_t)length;
+    file->is_mapped = False;
+    return 0;
+}
+
+// Opens the file at path and maps (or reads) it. Returns 0, or an errno
+// value. Called without the GIL.
+static int
+file_data_open(const char *path, FileData *file)
+{
+    FILE *fileobj;
+    int error;
+    #ifdef CHJSON_MMAP
+    int fd;
+    struct stat st;
+    long page_size;
+    volatile unsigned char touched = 0;
+    Py_ssize_t i;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return errno;
+    }
+    if (fstat(fd, &st) == -1) {
+        error = errno;
+        close(fd);
+        return error;
+    }
+    // (A MAP_PRIVATE mapping still sees what other processes write to the
+    // file. The decoder only counts on what it's measured as far as the
+    // mapping's length, see build_string(), so a file that's rewritten
+    // underneath it fails with a DecodeError, but pages that a truncation
+    // cuts off fault with SIGBUS, which there's no guarding against.)
+    if (S_ISREG(st.st_mode) && (st.st_size > 0) && (st.st_size <= PY_SSIZE_T_MAX)) {
+        file->data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file->data != MAP_FAILED) {
+            close(fd);
+            file->length = (Py_ssize_t)st.st_size;
+            file->is_mapped = True;
+            // The decoder reads it front to back, once, and it's faulted in
+            // now, while other threads can run, rather than while parsing.
+            #ifdef MADV_SEQUENTIAL
+            madvise(file->data, (size_t)file->length, MADV_SEQUENTIAL);
+            #endif
+            page_size = sysconf(_SC_PAGESIZE);
+            if (page_size <= 0) {
+                page_size = 4096;
+            }
+            for (i = 0; i < file->length; i += page_size) {
+                touched += ((unsigned char *)file->data)[i];
+            }
+            return 0;
+        }
+    }
+    // An empty or special file (or one that couldn't be mapped) is read.
+    fileobj = fdopen(fd, "rb");
+    if (fileobj == NULL) {
+        error = errno;
+        close(fd);
+        return error;
+    }
+    #else
+    fileobj = fopen(path, "rb");
+    if (fileobj == NULL) {
+        return errno;
+    }
+    #endif
+    error = file_data_read(fileobj, file);
+    fclose(fileobj);
+    return error;
+}
+
+static void
+file_data_close(FileData *file)
+{
+    #ifdef CHJSON_MMAP
+    if (file->is_mapped) {
+        munmap(file->data, (size_t)file->length);
+        return;
+    }
+    #endif
+    PyMem_RawFree(file->data);
+}
+
+// Adds the file's name to the front of the DecodeError being raised.
+static void
+decode_error_add_name(PyObject *name)
+{
+    PyObject *type, *value, *traceback, *message;
+
+    if (!PyErr_ExceptionMatches(JSON_DecodeError)) {
+        return;
+    }
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    message = PyObject_Str(value);
+    if (message == NULL) {
+        PyErr_Restore(type, value, traceback);
+        return;
+    }
+    PyErr_Format(JSON_DecodeError, "%U: %U", name, message);
+    Py_DECREF(message);
+    Py_XDECREF(type);
+    Py_XDECREF(value);
+    Py_XDECREF(traceback);
+}
+
+// Decode the JSON file at path into python objects
+static PyObject *
+JSON_decode_file(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"path", "strict", "max_depth", NULL};
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *object, *path, *name;
+    FileData file = {NULL, 0, False};
+    int error;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O&|in:decode_file", kwlist,
+        PyUnicode_FSConverter, &path, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+
+    name = PyUnicode_DecodeFSDefaultAndSize(PyBytes_AS_STRING(path), PyBytes_GET_SIZE(path));
+    if (name == NULL) {
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    error = file_data_open(PyBytes_AS_STRING(path), &file);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(path);
+
+    if (error != 0) {
+        errno = error;
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, name);
+        Py_DECREF(name);
+        return NULL;
+    }
+
+    object = decode_buffer(
+        file.data, file.length, PyUnicode_1BYTE_KIND, True, False, strict, max_depth
+    );
+    if (object == NULL) {
+        decode_error_add_name(name);
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    file_data_close(&file);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(name);
+
+    return object;
+}
+
+// *** Streams of values
+
+// iterdecode()'s iterator, which decodes one value of the stream at a time,
+// picking up (with the one JSONData) where the last one ended.
+typedef struct DecodeIteratorObject {
+    PyObject_HEAD
+    PyObject *json; // (which source is of)
+    Source source;
+    const DecoderVariant *variant;
+    JSONData jsondata;
+    int is_done;
+} DecodeIteratorObject;
+
+static PyTypeObject DecodeIteratorType;
+
+// Decode a stream of JSON values, one at a time
+static PyObject *
+JSON_iterdecode(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "strict", "max_depth", NULL};
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *string;
+    Source source;
+    DecodeIteratorObject *iterator;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|in:iterdecode", kwlist, &string, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+
+    if (source_open(&source, string) == -1) {
+        return NULL;
+    }
+    iterator = PyObject_New(DecodeIteratorObject, &DecodeIteratorType);
+    if (iterator == NULL) {
+        source_close(&source);
+        return NULL;
+    }
+    Py_INCREF(string);
+    iterator->json = string;
+    iterator->source = source;
+    iterator->variant = decoder_variant(iterator->source.kind, iterator->source.is_utf8, strict);
+    jsondata_init(
+        &iterator->jsondata, iterator->source.str, iterator->source.length,
+        iterator->source.kind, max_depth
+    );
+    // Each value's tokenized a chunk at a time, with the GIL, since there's
+    // no telling how big it is: most streams are of many small values.
+    iterator->jsondata.tape_limit = TAPE_CHUNK;
+    iterator->is_done = False;
+    return (PyObject *)iterator;
+}
+
+static void
+DecodeIterator_dealloc(DecodeIteratorObject *self)
+{
+    jsondata_free(&self->jsondata);
+    source_close(&self->source);
+    Py_DECREF(self->json);
+    PyObject_Del(self);
+}
+
+static PyObject *
+DecodeIterator_next(DecodeIteratorObject *self)
+{
+    JSONData *jsondata = &self->jsondata;
+    const DecoderVariant *variant = self->variant;
+    PyObject *object;
+    int status;
+
+    if (self->is_done) {
+        return NULL;
+    }
+    variant->skip_spaces(jsondata);
+    if (jsondata->ptr >= jsondata->end) {
+        self->is_done = True;
+        return NULL;
+    }
+    jsondata->tape_size = 0;
+    jsondata->tape_read = 0;
+    status = variant->tokenize_value(jsondata);
+    object = jsondata_build(jsondata, variant, variant->tokenize_value, status);
+    if (object == NULL) {
+        // There's no telling where the next value would start.
+        self->is_done = True;
+    }
+    return object;
+}
+
+static PyTypeObject DecodeIteratorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "chjson.DecodeIterator",
+    .tp_basicsize = sizeof(DecodeIteratorObject),
+    .tp_dealloc = (destructor)DecodeIterator_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)DecodeIterator_next,
+};
+
+// *** Batches
+
+// One of decode_many()'s documents, which is tokenized by whichever thread
+// gets to it first, and then built (in order) by the calling thread.
+typedef struct BatchItem {
+    Source source;
+    JSONData jsondata;
+    const DecoderVariant *variant;
+    // If it's tokenized as it's built, instead (because it's mutable, or
+    // there's only the one thread anyway).
+    int is_deferred;
+    int status; // tokenize_document()'s
+} BatchItem;
+
+typedef struct Batch {
+    BatchItem *items;
+    Py_ssize_t n_items;
+    // The next item to tokenize, and how many threads (the calling thread
+    // included) are still at it, both guarded by lock. Each thread takes
+    // step items at a time.
+    Py_ssize_t next;
+    Py_ssize_t step;
+    int n_running;
+    PyThread_type_lock lock;
+    // Held until the last thread's done.
+    PyThread_type_lock done;
+} Batch;
+
+// Tokenizes items until there are none left, then checks out (releasing
+// batch->done if it's the last thread to). Doesn't need the GIL.
+static void
+batch_work(void *arg)
+{
+    Batch *batch = (Batch *)arg;
+    BatchItem *item;
+    Py_ssize_t i, stop;
+    int is_last;
+
+    while (True) {
+        PyThread_acquire_lock(batch->lock, WAIT_LOCK);
+        i = batch->next;
+        batch->next += batch->step;
+        PyThread_release_lock(batch->lock);
+        if (i >= batch->n_items) {
+            break;
+        }
+        stop = (i + batch->step < batch->n_items) ? i + batch->step : batch->n_items;
+        for (; i < stop; i++) {
+            item = &batch->items[i];
+            if (!item->is_deferred) {
+                item->status = item->variant->tokenize_document(&item->jsondata);
+            }
+        }
+    }
+
+    PyThread_acquire_lock(batch->lock, WAIT_LOCK);
+    is_last = (--batch->n_running == 0);
+    PyThread_release_lock(batch->lock);
+    if (is_last) {
+        PyThread_release_lock(batch->done);
+    }
+}
+
+// How many threads decode_many() uses by default: one per CPU.
+static int
+cpu_count(void)
+{
+    #if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (count >= 1) {
+        return (count < INT_MAX) ? (int)count : INT_MAX;
+    }
+    #endif
+    return 1;
+}
+
+// Returns how many threads to use, for a threads argument of n_threads: one
+// per CPU by default, and no more than that, however many are asked for (as
+// the rest would only take turns on the CPUs, each with its own stack).
+static int
+thread_count(int n_threads)
+{
+    int n_cpus = cpu_count();
+
+    return ((n_threads == 0) || (n_threads > n_cpus)) ? n_cpus : n_threads;
+}
+
+#define BATCH_MAX_STEP 64
+
+// Starts tokenizing the batch's items on up to n_workers new threads, which
+// the calling thread joins in batch_finish(). Doesn't need the GIL.
+static void
+batch_start(Batch *batch, int n_workers)
+{
+    int i;
+
+    // (No more threads than there are items for them.)
+    if (n_workers > batch->n_items - 1) {
+        n_workers = (int)Py_MAX(batch->n_items - 1, 0);
+    }
+    batch->next = 0;
+    // (Small enough steps that the threads finish about together, even if
+    // some documents are much bigger than others.)
+    batch->step = batch->n_items / (((Py_ssize_t)n_workers + 1) * 16);
+    if (batch->step < 1) {
+        batch->step = 1;
+    }
+    else if (batch->step > BATCH_MAX_STEP) {
+        batch->step = BATCH_MAX_STEP;
+    }
+    batch->n_running = 1;
+    PyThread_acquire_lock(batch->done, WAIT_LOCK);
+
+    for (i = 0; i < n_workers; i++) {
+        PyThread_acquire_lock(batch->lock, WAIT_LOCK);
+        batch->n_running++;
+        PyThread_release_lock(batch->lock);
+        if (PyThread_start_new_thread(batch_work, batch) == PYTHREAD_INVALID_THREAD_ID) {
+            // Make do with the threads there are.
+            PyThread_acquire_lock(batch->lock, WAIT_LOCK);
+            batch->n_running--;
+            PyThread_release_lock(batch->lock);
+            break;
+        }
+    }
+}
+
+// Tokenizes the rest of the batch's items, alongside the threads that
+// batch_start() started, and waits for them. Doesn't need the GIL.
+static void
+batch_finish(Batch *batch)
+{
+    batch_work(batch);
+    PyThread_acquire_lock(batch->done, WAIT_LOCK);
+    PyThread_release_lock(batch->done);
+}
+
+// Tokenizes all the batch's items, on up to n_threads threads (the calling
+// one included), without the GIL.
+static void
+batch_tokenize(Batch *batch, int n_threads)
+{
+    Py_BEGIN_ALLOW_THREADS
+    batch_start(batch, n_threads - 1);
+    batch_finish(batch);
+    Py_END_ALLOW_THREADS
+}
+
+// Readies the document (a str, or a buffer of UTF-8) to be tokenized.
+static int
+batch_item_init(
+    BatchItem *item, PyObject *document, int is_deferred, int strict, Py_ssize_t max_depth
+) {
+    if (source_open(&item->source, document) == -1) {
+        return -1;
+    }
+    jsondata_init(
+        &item->jsondata, item->source.str, item->source.length, item->source.kind, max_depth
+    );
+    item->variant = decoder_variant(item->source.kind, item->source.is_utf8, strict);
+    item->is_deferred = is_deferred || item->source.is_mutable;
+    return 0;
+}
+
+static void
+batch_item_free(BatchItem *item)
+{
+    jsondata_free(&item->jsondata);
+    source_close(&item->source);
+}
+
+// Builds the item's document, or returns the DecodeError it raised.
+static PyObject *
+batch_item_build(BatchItem *item)
+{
+    PyObject *object, *type, *value, *traceback;
+
+    if (item->is_deferred) {
+        item->status = jsondata_tokenize(
+            &item->jsondata, item->variant->tokenize_document, item->source.is_mutable
+        );
+    }
+    object = jsondata_build(
+        &item->jsondata, item->variant, item->variant->tokenize_document, item->status
+    );
+    if ((object != NULL) || (!PyErr_ExceptionMatches(JSON_DecodeError))) {
+        return object;
+    }
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    if (traceback != NULL) {
+        PyException_SetTraceback(value, traceback);
+    }
+    Py_XDECREF(type);
+    Py_XDECREF(traceback);
+    return value;
+}
+
+// Decode a sequence of JSON representations, in parallel, into a list
+static PyObject *
+JSON_decode_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"documents", "threads", "strict", "max_depth", NULL};
+    int n_threads = 0; // one per CPU
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *documents, *list = NULL, *object;
+    Batch batch;
+    BatchItem item;
+    Py_ssize_t i, n_ready = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|iin:decode_many", kwlist, &documents, &n_threads, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+        return NULL;
+    }
+    n_threads = thread_count(n_threads);
+
+    // (A tuple, so that the documents can't go away while they're parsed.)
+    documents = PySequence_Tuple(documents);
+    if (documents == NULL) {
+        return NULL;
+    }
+    batch.n_items = PyTuple_GET_SIZE(documents);
+    list = PyList_New(batch.n_items);
+    if (list == NULL) {
+        Py_DECREF(documents);
+        return NULL;
+    }
+
+    if ((n_threads == 1) || (batch.n_items <= 1)) {
+        // There's nothing to do in parallel, so decode them one at a time,
+        // as decode() would.
+        for (i = 0; i < batch.n_items; i++) {
+            object = NULL;
+            if (batch_item_init(&item, PyTuple_GET_ITEM(documents, i), True, strict, max_depth) == 0) {
+                object = batch_item_build(&item);
+                batch_item_free(&item);
+            }
+            if (object == NULL) {
+                Py_CLEAR(list);
+                break;
+            }
+            PyList_SET_ITEM(list, i, object);
+        }
+        Py_DECREF(documents);
+        return list;
+    }
+
+    batch.items = PyMem_New(BatchItem, batch.n_items);
+    batch.lock = PyThread_allocate_lock();
+    batch.done = PyThread_allocate_lock();
+    if ((batch.items == NULL) || (batch.lock == NULL) || (batch.done == NULL)) {
+        Py_CLEAR(list);
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (; n_ready < batch.n_items; n_ready++) {
+        if (batch_item_init(
+            &batch.items[n_ready], PyTuple_GET_ITEM(documents, n_ready), False, strict, max_depth) == -1
+        ) {
+            Py_CLEAR(list);
+            goto done;
+        }
+    }
+
+    batch_tokenize(&batch, n_threads);
+
+    for (i = 0; i < batch.n_items; i++) {
+        object = batch_item_build(&batch.items[i]);
+        if (object == NULL) {
+            Py_CLEAR(list);
+            goto done;
+        }
+        PyList_SET_ITEM(list, i, object);
+        // (Done with its tape.)
+        jsondata_free(&batch.items[i].jsondata);
+    }
+
+done:
+    for (i = 0; i < n_ready; i++) {
+        batch_item_free(&batch.items[i]);
+    }
+    PyMem_Free(batch.items);
+    if (batch.lock != NULL) {
+        PyThread_free_lock(batch.lock);
+    }
+    if (batch.done != NULL) {
+        PyThread_free_lock(batch.done);
+    }
+    Py_DECREF(documents);
+
+    return list;
+}
+
+// *** Lines
+
+// decode_lines() and iterdecode_lines() split JSON Lines input (a file, or
+// a buffer of UTF-8) at its newlines, and decode each line as a document
+// (skipping blank ones). The lines are taken a window at a time, as a
+// Batch: while one window's lines are built, with the GIL, the next one's
+// are tokenized, on native threads without it. So whatever the size of the
+// input, there are only ever two windows' tapes.
+typedef struct LinesObject {
+    PyObject_HEAD
+    PyObject *name; // the file's, for errors (or NULL, for a buffer)
+    FileData file;
+    PyObject *json; // the buffer's owner (or NULL, for a file)
+    Source source;
+    Py_UCS1 *data;
+    Py_UCS1 *end;
+    Py_UCS1 *next; // where the next line starts
+    long lineno; // the next line's number
+    const DecoderVariant *variant;
+    Py_ssize_t max_depth;
+    int n_workers; // threads, besides the calling one
+    // If the buffer's mutable: then each line is tokenized as it's built,
+    // instead, as decode_many() does.
+    int is_deferred;
+    // The window that's being built from, and the other one, which is
+    // being tokenized (if is_running) unless it's empty (at the end).
+    Batch windows[2];
+    int is_running[2];
+    int current;
+    Py_ssize_t n_built; // of the current window's items
+} LinesObject;
+
+#define LINES_WINDOW_LINES 2048
+#define LINES_WINDOW_BYTES (1024 * 1024)
+
+static PyTypeObject LinesType;
+
+// Splits the next window's worth of lines off into the window's items.
+static void
+lines_fill(LinesObject *self, Batch *window)
+{
+    BatchItem *item;
+    Py_UCS1 *line, *line_end, *newline;
+    Py_UCS1 *start = self->next;
+    long lineno;
+
+    // (Blank lines don't count, so a window's only empty at the end, however
+    // many of them there are in a row.)
+    window->n_items = 0;
+    while ((self->next < self->end)
+        && (window->n_items < LINES_WINDOW_LINES)
+        && ((window->n_items == 0) || (self->next - start < LINES_WINDOW_BYTES))
+    ) {
+        line = self->next;
+        newline = memchr(line, '\n', self->end - line);
+        line_end = (newline != NULL) ? newline : self->end;
+        self->next = (newline != NULL) ? newline + 1 : self->end;
+        lineno = self->lineno++;
+        if ((line_end > line) && (line_end[-1] == '\r')) {
+            line_end--;
+        }
+        if (line_end == line) {
+            continue;
+        }
+        item = &window->items[window->n_items++];
+        item->source.view.obj = NULL;
+        jsondata_init(&item->jsondata, line, line_end - line, PyUnicode_1BYTE_KIND, self->max_depth);
+        // Positioned as decode() would report it: the line's offsets count
+        // from the newline before it (the CR, of a CR/LF).
+        item->jsondata.lineno = lineno;
+        if (line > self->data) {
+            item->jsondata.line_start = line - 1;
+            if ((line - 1 > self->data) && (line[-2] == '\r')) {
+                item->jsondata.line_start = line - 2;
+            }
+        }
+        item->variant = self->variant;
+        item->is_deferred = self->is_deferred;
+    }
+}
+
+// Starts tokenizing the window (see batch_start()), unless its lines are
+// deferred.
+static void
+lines_start(LinesObject *self, int which)
+{
+    Batch *window = &self->windows[which];
+
+    if ((window->n_items > 0) && (!self->is_deferred)) {
+        batch_start(window, self->n_workers);
+        self->is_running[which] = True;
+    }
+}
+
+// Waits for the window to be tokenized, helping out meanwhile.
+static void
+lines_finish(LinesObject *self, int which)
+{
+    if (self->is_running[which]) {
+        Py_BEGIN_ALLOW_THREADS
+        batch_finish(&self->windows[which]);
+        Py_END_ALLOW_THREADS
+        self->is_running[which] = False;
+    }
+}
+
+// Stops, freeing the lines that haven't been built.
+static void
+lines_clear(LinesObject *self)
+{
+    Batch *window;
+    Py_ssize_t i;
+    int which;
+
+    for (which = 0; which < 2; which++) {
+        lines_finish(self, which);
+        window = &self->windows[which];
+        for (i = (which == self->current) ? self->n_built : 0; i < window->n_items; i++) {
+            batch_item_free(&window->items[i]);
+        }
+        window->n_items = 0;
+    }
+    self->n_built = 0;
+    self->next = self->end;
+}
+
+// Opens the input: the file at the path (a str, bytes or os.PathLike; or
+// rather, bytes are a buffer), or the buffer of UTF-8.
+static LinesObject *
+lines_new(PyObject *input, int n_threads, int strict, Py_ssize_t max_depth)
+{
+    LinesObject *self;
+    PyObject *path;
+    int which, error;
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+        return NULL;
+    }
+    n_threads = thread_count(n_threads);
+
+    self = (LinesObject *)LinesType.tp_alloc(&LinesType, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->variant = decoder_variant(PyUnicode_1BYTE_KIND, True, strict);
+    self->max_depth = max_depth;
+    self->n_workers = n_threads - 1;
+    self->lineno = 1;
+    // (Starting out at the end of an empty window.)
+    self->current = 1;
+
+    if (PyUnicode_Check(input) || !PyObject_CheckBuffer(input)) {
+        if (!PyUnicode_FSConverter(input, &path)) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        self->name = PyUnicode_DecodeFSDefaultAndSize(PyBytes_AS_STRING(path), PyBytes_GET_SIZE(path));
+        if (self->name == NULL) {
+            Py_DECREF(path);
+            Py_DECREF(self);
+            return NULL;
+        }
+        Py_BEGIN_ALLOW_THREADS
+        error = file_data_open(PyBytes_AS_STRING(path), &self->file);
+        Py_END_ALLOW_THREADS
+        Py_DECREF(path);
+        if (error != 0) {
+            errno = error;
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->name);
+            self->file.data = NULL;
+            Py_DECREF(self);
+            return NULL;
+        }
+        self->data = self->file.data;
+        self->end = self->data + self->file.length;
+    }
+    else {
+        if (source_open(&self->source, input) == -1) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        Py_INCREF(input);
+        self->json = input;
+        self->data = self->source.str;
+        self->end = self->data + self->source.length;
+        self->is_deferred = self->source.is_mutable;
+    }
+    self->next = self->data;
+
+    for (which = 0; which < 2; which++) {
+        self->windows[which].items = PyMem_New(BatchItem, LINES_WINDOW_LINES);
+        self->windows[which].lock = PyThread_allocate_lock();
+        self->windows[which].done = PyThread_allocate_lock();
+        if ((self->windows[which].items == NULL)
+            || (self->windows[which].lock == NULL)
+            || (self->windows[which].done == NULL)
+        ) {
+            Py_DECREF(self);
+            PyErr_NoMemory();
+            return NULL;
+        }
+    }
+
+    lines_fill(self, &self->windows[0]);
+    lines_start(self, 0);
+    return self;
+}
+
+static void
+Lines_dealloc(LinesObject *self)
+{
+    int which;
+
+    lines_clear(self);
+    for (which = 0; which < 2; which++) {
+        PyMem_Free(self->windows[which].items);
+        if (self->windows[which].lock != NULL) {
+            PyThread_free_lock(self->windows[which].lock);
+        }
+        if (self->windows[which].done != NULL) {
+            PyThread_free_lock(self->windows[which].done);
+        }
+    }
+    if (self->json != NULL) {
+        source_close(&self->source);
+        Py_DECREF(self->json);
+    }
+    if (self->file.data != NULL) {
+        Py_BEGIN_ALLOW_THREADS
+        file_data_close(&self->file);
+        Py_END_ALLOW_THREADS
+    }
+    Py_XDECREF(self->name);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+Lines_next(LinesObject *self)
+{
+    Batch *window;
+    BatchItem *item;
+    PyObject *object;
+    int other;
+
+    while (True) {
+        window = &self->windows[self->current];
+        if (self->n_built < window->n_items) {
+            item = &window->items[self->n_built++];
+            if (item->is_deferred) {
+                item->status = item->variant->tokenize_document(&item->jsondata);
+            }
+            if (item->status == -1) {
+                if ((item->jsondata.error == Error_Empty)
+                    && (item->jsondata.error_at == item->jsondata.end)
+                ) {
+                    // A blank line (or, if loose, one with just a comment).
+                    batch_item_free(item);
+                    continue;
+                }
+                // (Counted only now, since it takes a pass over the input.)
+                item->jsondata.position_base = utf8_count(self->data, item->jsondata.str);
+            }
+            object = jsondata_build(
+                &item->jsondata, item->variant, item->variant->tokenize_document, item->status
+            );
+            batch_item_free(item);
+            if (object == NULL) {
+                if (self->name != NULL) {
+                    decode_error_add_name(self->name);
+                }
+                lines_clear(self);
+            }
+            return object;
+        }
+
+        // On to the other window (which has been tokenized, or nearly),
+        // and start on the one after it.
+        other = 1 - self->current;
+        if (self->windows[other].n_items == 0) {
+            return NULL;
+        }
+        lines_finish(self, other);
+        self->current = other;
+        self->n_built = 0;
+        lines_fill(self, &self->windows[1 - other]);
+        lines_start(self, 1 - other);
+    }
+}
+
+static PyTypeObject LinesType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "chjson.LineIterator",
+    .tp_basicsize = sizeof(LinesObject),
+    .tp_dealloc = (destructor)Lines_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)Lines_next,
+};
+
+// Decode each line of a JSON Lines file (or buffer), in parallel, into a list
+static PyObject *
+JSON_decode_lines(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"input", "threads", "strict", "max_depth", NULL};
+    int n_threads = 0; // one per CPU
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *input, *list, *object;
+    LinesObject *lines;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|iin:decode_lines", kwlist, &input, &n_threads, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    list = PyList_New(0);
+    if (list == NULL) {
+        return NULL;
+    }
+    lines = lines_new(input, n_threads, strict, max_depth);
+    if (lines == NULL) {
+        Py_DECREF(list);
+        return NULL;
+    }
+    while ((object = Lines_next(lines)) != NULL) {
+        if (PyList_Append(list, object) == -1) {
+            Py_DECREF(object);
+            break;
+        }
+        Py_DECREF(object);
+    }
+    Py_DECREF(lines);
+    if (PyErr_Occurred()) {
+        Py_CLEAR(list);
+    }
+
+    return list;
+}
+
+// Decode each line of a JSON Lines file (or buffer), in parallel, in turn
+static PyObject *
+JSON_iterdecode_lines(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"input", "threads", "strict", "max_depth", NULL};
+    int n_threads = 0; // one per CPU
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *input;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|iin:iterdecode_lines", kwlist, &input, &n_threads, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    return (PyObject *)lines_new(input, n_threads, strict, max_depth);
+}
+
+// *** Incremental decoding
+
+// A Decoder parses a stream of JSON values as it's fed, in chunks. Each
+// chunk is tokenized as far as it goes, and built from right away, with
+// the tokenizing and building frames (and the scratch stack) kept between
+// chunks. But tokenizing can't tell the end of the input so far from the
+// end of a token (a number, say) that goes on in the next chunk, so it's
+// done from a checkpoint (each time the tape's built from), and goes back
+// to it if it got to the end (see decoder_stopped_short). The input
+// before a checkpoint is dropped once there's no value left open.
+typedef struct DecoderObject {
+    PyObject_HEAD
+    const DecoderVariant *variant;
+    JSONData jsondata;
+    DecoderCache cache;
+    // The input that's not been dropped yet (which is jsondata.str).
+    Py_UCS1 *data;
+    Py_ssize_t size;
+    Py_ssize_t capacity;
+    // The checkpoint's tokenizing frames.
+    Frame *saved_frames;
+    Py_ssize_t saved_capacity;
+    // How much input there was after the checkpoint when tokenizing last
+    // came up short: it's not tried again until there's a fair bit more,
+    // so that a long string, say, isn't tokenized over and over.
+    Py_ssize_t short_size;
+    // An error that's to be raised by the next call (having been put off
+    // so that the values before it could be returned).
+    PyObject *error_type;
+    PyObject *error_value;
+    PyObject *error_traceback;
+    int is_closed;
+} DecoderObject;
+
+// How many tape entries are tokenized (and built) between checkpoints: not
+// many, so that there's never much to tokenize again.
+#define DECODER_TAPE_CHUNK 128
+
+static PyTypeObject DecoderType;
+
+static PyObject *
+Decoder_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"strict", "max_depth", NULL};
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    DecoderObject *self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|in:Decoder", kwlist, &strict, &max_depth)) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+
+    self = (DecoderObject *)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    // (Chunks are UTF-8, or str, which is encoded as such.)
+    self->variant = decoder_variant(PyUnicode_1BYTE_KIND, True, strict);
+    jsondata_init(&self->jsondata, NULL, 0, PyUnicode_1BYTE_KIND, max_depth);
+    self->jsondata.tape_limit = DECODER_TAPE_CHUNK;
+    // Its own cache, since the shapes of the objects that are still being
+    // built mustn't change between chunks.
+    decoder_cache_init(&self->cache);
+    self->jsondata.cache = &self->cache;
+    return (PyObject *)self;
+}
+
+static void
+Decoder_dealloc(DecoderObject *self)
+{
+    jsondata_free(&self->jsondata);
+    decoder_cache_clear(&self->cache);
+    PyMem_Free(self->data);
+    PyMem_Free(self->saved_frames);
+    Py_XDECREF(self->error_type);
+    Py_XDECREF(self->error_value);
+    Py_XDECREF(self->error_traceback);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// Points jsondata at the input, wherever the data now is.
+static void
+decoder_rebase(DecoderObject *self, Py_UCS1 *data)
+{
+    JSONData *jsondata = &self->jsondata;
+    Py_ssize_t i;
+
+    if (jsondata->str == NULL) {
+        jsondata->ptr = data;
+        jsondata->line_start = data;
+    }
+    else {
+        jsondata->ptr = data + ((Py_UCS1 *)jsondata->ptr - (Py_UCS1 *)jsondata->str);
+        jsondata->line_start = data + ((Py_UCS1 *)jsondata->line_start - (Py_UCS1 *)jsondata->str);
+        for (i = 0; i < jsondata->tokenizing.size; i++) {
+            jsondata->tokenizing.frames[i].start =
+                data + ((Py_UCS1 *)jsondata->tokenizing.frames[i].start - (Py_UCS1 *)jsondata->str);
+        }
+    }
+    jsondata->str = data;
+    jsondata->end = data + self->size;
+}
+
+// Drops the input before ptr, which has all been tokenized, and built from
+// (usually, it's between values).
+static void
+decoder_drop(DecoderObject *self)
+{
+    JSONData *jsondata = &self->jsondata;
+    Py_UCS1 *cut = (Py_UCS1 *)jsondata->ptr;
+    Py_UCS1 *start;
+    Py_ssize_t n = cut - self->data;
+    Py_ssize_t i;
+
+    if (n == 0) {
+        return;
+    }
+    jsondata->position_base += utf8_count(self->data, cut);
+    if ((Py_UCS1 *)jsondata->line_start < cut) {
+        // The line goes on: count what's dropped of it.
+        jsondata->line_base = utf8_count(jsondata->line_start, cut)
+            + ((jsondata->lineno == jsondata->line_base_lineno) ? jsondata->line_base : 0);
+        jsondata->line_base_lineno = jsondata->lineno;
+        jsondata->line_start = cut;
+    }
+    // The arrays and objects that are still open keep their opening
+    // brackets, for the error if they're never closed, unless those are
+    // dropped, too (see iter_path()): then they're reported as starting
+    // where the input that's kept does.
+    for (i = 0; i < jsondata->tokenizing.size; i++) {
+        start = jsondata->tokenizing.frames[i].start;
+        jsondata->tokenizing.frames[i].start = self->data + ((start > cut) ? start - cut : 0);
+    }
+    memmove(self->data, cut, self->size - n);
+    self->size -= n;
+    jsondata->line_start = self->data + ((Py_UCS1 *)jsondata->line_start - cut);
+    jsondata->ptr = self->data;
+    jsondata->str = self->data;
+    jsondata->end = self->data + self->size;
+}
+
+static int
+decoder_append(DecoderObject *self, const char *chunk, Py_ssize_t length)
+{
+    Py_UCS1 *data;
+    Py_ssize_t capacity;
+
+    if (length > self->capacity - self->size) {
+        if (length > PY_SSIZE_T_MAX - self->size) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        capacity = (self->capacity < PY_SSIZE_T_MAX / 2) ? self->capacity * 2 : PY_SSIZE_T_MAX;
+        if (capacity < self->size + length) {
+            capacity = self->size + length;
+        }
+        data = PyMem_Realloc(self->data, capacity);
+        if (data == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->data = data;
+        self->capacity = capacity;
+    }
+    memcpy(self->data + self->size, chunk, length);
+    self->size += length;
+    decoder_rebase(self, self->data);
+    return 0;
+}
+
+// Remembers where tokenizing is, to go back to (see decoder_restore).
+static int
+decoder_save(DecoderObject *self, Py_UCS1 **ptr, long *lineno, void **line_start)
+{
+    FrameStack *stack = &self->jsondata.tokenizing;
+    Frame *frames;
+
+    if (stack->size > self->saved_capacity) {
+        frames = PyMem_Resize(self->saved_frames, Frame, stack->capacity);
+        if (frames == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->saved_frames = frames;
+        self->saved_capacity = stack->capacity;
+    }
+    if (stack->size > 0) {
+        memcpy(self->saved_frames, stack->frames, stack->size * sizeof(Frame));
+    }
+    *ptr = (Py_UCS1 *)self->jsondata.ptr;
+    *lineno = self->jsondata.lineno;
+    *line_start = self->jsondata.line_start;
+    return 0;
+}
+
+static void
+decoder_restore(
+    DecoderObject *self, Py_UCS1 *ptr, long lineno, void *line_start, Py_ssize_t n_frames
+) {
+    JSONData *jsondata = &self->jsondata;
+
+    // (The frames were pushed in place, so there's room.)
+    if (n_frames > 0) {
+        memcpy(jsondata->tokenizing.frames, self->saved_frames, n_frames * sizeof(Frame));
+    }
+    jsondata->tokenizing.size = n_frames;
+    jsondata->ptr = ptr;
+    jsondata->lineno = lineno;
+    jsondata->line_start = line_start;
+    jsondata->tape_size = 0;
+    jsondata->tape_read = 0;
+    jsondata->error = Error_None;
+}
+
+// Returns True if the literal (or its sign, or the start of it) is all
+// that's left of the input at ptr.
+static int
+literal_cut_short(const Py_UCS1 *ptr, const Py_UCS1 *end)
+{
+    static const char *literals[] = {
+        "null", "true", "false", "NaN", "Infinity", "-Infinity", "+Infinity", NULL
+    };
+    const char **literal;
+
+    for (literal = literals; *literal != NULL; literal++) {
+        if ((end - ptr < (Py_ssize_t)strlen(*literal)) && (memcmp(ptr, *literal, end - ptr) == 0)) {
+            return True;
+        }
+    }
+    return False;
+}
+
+// Returns True if tokenizing failed only because it got to the end of the
+// input so far (so that more input might fix it).
+static int
+decoder_stopped_short(DecoderObject *self)
+{
+    JSONData *jsondata = &self->jsondata;
+    const Py_UCS1 *at = jsondata->error_at;
+    const Py_UCS1 *end = jsondata->end;
+    Py_UCS1 quote;
+
+    if ((jsondata->error == Error_NoMemory) || (jsondata->error == Error_MaxDepth)) {
+        return False;
+    }
+    if (((Py_UCS1 *)jsondata->ptr >= end) || (at >= end)) {
+        return True;
+    }
+    switch (jsondata->error) {
+    case Error_Null:
+    case Error_Bool:
+    case Error_Inf:
+    case Error_NaN:
+        // (Or if the error message's snippet of the input would be, so that
+        // it quotes what iterdecode() would.)
+        return literal_cut_short(at, end) || (utf8_count(at, end) < SNIPPET_CHARS);
+    case Error_Number:
+        while ((at < end) && ((CHAR_CLASS(*at) & CC_NUMBER) || (*at == 'e') || (*at == 'E'))) {
+            at++;
+        }
+        return at == end;
+    case Error_UnterminatedString:
+    case Error_InvalidUTF8:
+        // If it hasn't been closed yet.
+        quote = *at++;
+        while (at < end) {
+            if (*at == '\\') {
+                at += 2;
+                continue;
+            }
+            if ((*at == quote) || (*at == '\0')) {
+                return False;
+            }
+            at++;
+        }
+        return True;
+    }
+    return False;
+}
+
+// Returns True if tokenizing (which stopped with the status) should be
+// tried again once there's more input: if it failed at the end of the
+// input so far, or if all there was was a number, which might go on.
+static int
+decoder_came_up_short(DecoderObject *self, int status)
+{
+    JSONData *jsondata = &self->jsondata;
+
+    if (status == -1) {
+        return decoder_stopped_short(self);
+    }
+    return (status == 0) && (jsondata->ptr == jsondata->end)
+        && (jsondata->tape_size == 1) && (jsondata->tape[0].type >= TAPE_INTEGER)
+        && (jsondata->tape[0].type <= TAPE_NUMBER);
+}
+
+// Tokenizes and builds as much of the input as there is, and returns the
+// list of the values that that finished. At the end of the input (if
+// is_final), there's no going back.
+static PyObject *
+decoder_run(DecoderObject *self, int is_final)
+{
+    JSONData *jsondata = &self->jsondata;
+    const DecoderVariant *variant = self->variant;
+    PyObject *values, *value;
+    Py_UCS1 *ptr;
+    void *line_start;
+    long lineno;
+    Py_ssize_t n_frames, pending;
+    int status;
+
+    values = PyList_New(0);
+    if (values == NULL) {
+        return NULL;
+    }
+
+    pending = (Py_UCS1 *)jsondata->end - (Py_UCS1 *)jsondata->ptr;
+    if ((!is_final) && (self->short_size > 0) && (pending - self->short_size < self->short_size / 4)) {
+        return values;
+    }
+    self->short_size = 0;
+
+    while (True) {
+        if (decoder_save(self, &ptr, &lineno, &line_start) == -1) {
+            goto failure;
+        }
+        n_frames = jsondata->tokenizing.size;
+
+        if ((n_frames == 0) && (jsondata->building.size == 0)) {
+            // Between values.
+            variant->skip_spaces(jsondata);
+            if (jsondata->ptr == jsondata->end) {
+                if (!is_final) {
+                    decoder_restore(self, ptr, lineno, line_start, n_frames);
+                }
+                break;
+            }
+        }
+
+        status = variant->tokenize_value(jsondata);
+        if ((!is_final) && decoder_came_up_short(self, status)) {
+            decoder_restore(self, ptr, lineno, line_start, n_frames);
+            self->short_size = (Py_UCS1 *)jsondata->end - ptr;
+            break;
+        }
+        if (status == -1) {
+            variant->raise_error(jsondata);
+            goto failure;
+        }
+
+        status = variant->build_value(jsondata, &value);
+        if (status == -1) {
+            goto failure;
+        }
+        jsondata->tape_size = 0;
+        jsondata->tape_read = 0;
+        if (status == 1) {
+            if (PyList_Append(values, value) == -1) {
+                Py_DECREF(value);
+                goto failure;
+            }
+            Py_DECREF(value);
+        }
+    }
+
+    if ((jsondata->tokenizing.size == 0) && (jsondata->building.size == 0)) {
+        decoder_drop(self);
+    }
+    return values;
+
+failure:
+    // There's no telling where to pick up from.
+    self->is_closed = True;
+    if ((!is_final) && (PyList_GET_SIZE(values) > 0) && PyErr_ExceptionMatches(JSON_DecodeError)) {
+        PyErr_Fetch(&self->error_type, &self->error_value, &self->error_traceback);
+        return values;
+    }
+    Py_DECREF(values);
+    return NULL;
+}
+
+// Raises the error that was put off, if there is one, or else the one for
+// using a closed Decoder.
+static void
+decoder_raise_closed(DecoderObject *self, const char *message)
+{
+    if (self->error_type != NULL) {
+        PyErr_Restore(self->error_type, self->error_value, self->error_traceback);
+        self->error_type = NULL;
+        self->error_value = NULL;
+        self->error_traceback = NULL;
+        return;
+    }
+    PyErr_SetString(PyExc_ValueError, message);
+}
+
+static PyObject *
+Decoder_feed(DecoderObject *self, PyObject *chunk)
+{
+    Py_buffer view;
+    const char *data;
+    Py_ssize_t length;
+    int result;
+
+    if (self->is_closed) {
+        decoder_raise_closed(self, "feed() on a closed Decoder");
+        return NULL;
+    }
+
+    if (PyUnicode_Check(chunk)) {
+        data = PyUnicode_AsUTF8AndSize(chunk, &length);
+        if (data == NULL) {
+            return NULL;
+        }
+        result = decoder_append(self, data, length);
+    }
+    else {
+        if (PyObject_GetBuffer(chunk, &view, PyBUF_SIMPLE) == -1) {
+            return NULL;
+        }
+        result = decoder_append(self, view.buf, view.len);
+        PyBuffer_Release(&view);
+    }
+    if (result == -1) {
+        return NULL;
+    }
+
+    return decoder_run(self, False);
+}
+
+static PyObject *
+Decoder_close(DecoderObject *self, PyObject *unused)
+{
+    PyObject *values;
+
+    if (self->is_closed) {
+        decoder_raise_closed(self, "close() on a closed Decoder");
+        return NULL;
+    }
+    values = decoder_run(self, True);
+    self->is_closed = True;
+    return values;
+}
+
+static PyMethodDef Decoder_methods[] = {
+    {
+        "feed",
+        (PyCFunction)Decoder_feed,
+        METH_O,
+        PyDoc_STR(
+            "feed(chunk) -> \n"
+            "Parse the next chunk of input (UTF-8 encoded bytes, or any other \n"
+            "buffer, or a str), and return the list of values that it finished.\n"
+        )
+    },
+    {
+        "close",
+        (PyCFunction)Decoder_close,
+        METH_NOARGS,
+        PyDoc_STR(
+            "close() -> \n"
+            "Finish parsing (so that a value that ends with the input, like a \n"
+            "number, is taken as it is), and return the list of values that \n"
+            "that finished. DecodeError is raised if the input stops in a value.\n"
+        )
+    },
+    {NULL, NULL}  // sentinel
+};
+
+static PyTypeObject DecoderType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "chjson.Decoder",
+    .tp_basicsize = sizeof(DecoderObject),
+    .tp_dealloc = (destructor)Decoder_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = PyDoc_STR(
+        "Decoder(strict=False, max_depth=1000) -> \n"
+        "An incremental decoder for a stream of JSON values (one or more, \n"
+        "separated by whitespace), which is fed the input a chunk at a time \n"
+        "and returns each value as soon as it's been parsed. The work's done \n"
+        "as the chunks arrive, and only the input for the values that haven't \n"
+        "finished yet is kept. The arguments are as for decode().\n"
+    ),
+    .tp_methods = Decoder_methods,
+    .tp_new = Decoder_new,
+};
+
+// *** Paths
+
+// iter_path()'s path, such as $.items[*], is a list of steps down from the
+// root: an object's member (.name or ['name']), an array's item ([n]), or
+// any member or item (.* or [*]).
+typedef enum {
+    Step_Key,
+    Step_Index,
+    Step_Any
+} StepType;
+
+typedef struct PathStep {
+    int type; // a StepType
+    PyObject *key; // Step_Key
+    Py_ssize_t index; // Step_Index
+} PathStep;
+
+// An array or object that's open, on the way down the path.
+typedef struct PathLevel {
+    int is_object;
+    Py_ssize_t index; // arrays: the next item's
+    int is_match; // objects: if the last key was the step's
+} PathLevel;
+
+// iter_path()'s iterator. The input's tokenized a tape at a time, as
+// decode() does, but the tape is walked, rather than built from, except for
+// the values at the end of the path, one at a time. So the rest of the
+// document (and the input, if it's read from a file, which is fed to a
+// Decoder) is never held any longer than it takes to get past it.
+typedef struct PathIteratorObject {
+    PyObject_HEAD
+    PathStep *steps;
+    Py_ssize_t n_steps;
+    // The input's either a str or buffer, parsed in place (with jsondata),
+    // or a file, which is read a chunk at a time (with stream's).
+    PyObject *json;
+    Source source;
+    JSONData jsondata;
+    PyObject *fileobj;
+    DecoderObject *stream;
+    int is_eof;
+    const DecoderVariant *variant;
+    // The walk: the levels on the path, how deep it is into a subtree that's
+    // not (if it's skipping one), and if a value's being built.
+    PathLevel *levels;
+    Py_ssize_t depth;
+    Py_ssize_t skipping;
+    int is_building;
+    // How tokenizing last stopped (see DecoderVariant).
+    int status;
+    int is_done;
+} PathIteratorObject;
+
+#define PATH_READ_SIZE (64 * 1024)
+
+static PyTypeObject PathIteratorType;
+
+static int
+path_add_step(PathIteratorObject *self, int type, PyObject *key, Py_ssize_t index)
+{
+    PathStep *steps;
+
+    steps = PyMem_Resize(self->steps, PathStep, self->n_steps + 1);
+    if (steps == NULL) {
+        Py_XDECREF(key);
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->steps = steps;
+    steps[self->n_steps].type = type;
+    steps[self->n_steps].key = key;
+    steps[self->n_steps].index = index;
+    self->n_steps++;
+    return 0;
+}
+
+// Parses the path into self->steps.
+static int
+path_parse(PathIteratorObject *self, PyObject *path)
+{
+    Py_ssize_t i, j, length, index;
+    Py_UCS4 c, quote;
+    PyObject *key;
+    int kind;
+    void *data;
+
+    if (PyUnicode_READY(path) == -1) {
+        return -1;
+    }
+    kind = PyUnicode_KIND(path);
+    data = PyUnicode_DATA(path);
+    length = PyUnicode_GET_LENGTH(path);
+
+    if ((length == 0) || (PyUnicode_READ(kind, data, 0) != '$')) {
+        goto invalid;
+    }
+    for (i = 1; i < length; ) {
+        c = PyUnicode_READ(kind, data, i++);
+        if ((c == '.') && (i < length) && (PyUnicode_READ(kind, data, i) == '*')) {
+            i++;
+            if (path_add_step(self, Step_Any, NULL, 0) == -1) {
+                return -1;
+            }
+        }
+        else if (c == '.') {
+            for (j = i; j < length; j++) {
+                c = PyUnicode_READ(kind, data, j);
+                if ((c == '.') || (c == '[')) {
+                    break;
+                }
+            }
+            if (j == i) {
+                goto invalid;
+            }
+            key = PyUnicode_Substring(path, i, j);
+            if ((key == NULL) || (path_add_step(self, Step_Key, key, 0) == -1)) {
+                return -1;
+            }
+            i = j;
+        }
+        else if ((c == '[') && (i < length)) {
+            c = PyUnicode_READ(kind, data, i);
+            if ((c == '\'') || (c == '"')) {
+                quote = c;
+                for (j = i + 1; (j < length) && (PyUnicode_READ(kind, data, j) != quote); j++) {
+                }
+                if ((j + 1 >= length) || (PyUnicode_READ(kind, data, j + 1) != ']')) {
+                    goto invalid;
+                }
+                key = PyUnicode_Substring(path, i + 1, j);
+                if ((key == NULL) || (path_add_step(self, Step_Key, key, 0) == -1)) {
+                    return -1;
+                }
+                i = j + 2;
+            }
+            else if ((c == '*') && (i + 1 < length) && (PyUnicode_READ(kind, data, i + 1) == ']')) {
+                if (path_add_step(self, Step_Any, NULL, 0) == -1) {
+                    return -1;
+                }
+                i += 2;
+            }
+            else {
+                index = 0;
+                for (j = i; (j < length) && Py_UNICODE_ISDIGIT(c = PyUnicode_READ(kind, data, j)); j++) {
+                    if (index > (PY_SSIZE_T_MAX - 9) / 10) {
+                        goto invalid;
+                    }
+                    index = index * 10 + (c - '0');
+                }
+                if ((j == i) || (j >= length) || (c != ']')) {
+                    goto invalid;
+                }
+                if (path_add_step(self, Step_Index, NULL, index) == -1) {
+                    return -1;
+                }
+                i = j + 1;
+            }
+        }
+        else {
+            goto invalid;
+        }
+    }
+    return 0;
+
+invalid:
+    PyErr_Format(PyExc_ValueError, "invalid path: %R", path);
+    return -1;
+}
+
+// Reads the next chunk of the file into the stream (or finds that there's
+// no more). Returns 0, or -1 with an exception set.
+static int
+path_read(PathIteratorObject *self)
+{
+    PyObject *chunk;
+    Py_buffer view;
+    const char *data;
+    Py_ssize_t length;
+    int result;
+
+    chunk = PyObject_CallMethod(self->fileobj, "read", "n", (Py_ssize_t)PATH_READ_SIZE);
+    if (chunk == NULL) {
+        return -1;
+    }
+    // (A text file's read as it'd be fed to a Decoder.)
+    if (PyUnicode_Check(chunk)) {
+        data = PyUnicode_AsUTF8AndSize(chunk, &length);
+        result = (data == NULL) ? -1 : decoder_append(self->stream, data, length);
+    }
+    else if (PyObject_GetBuffer(chunk, &view, PyBUF_SIMPLE) == 0) {
+        length = view.len;
+        result = decoder_append(self->stream, view.buf, view.len);
+        PyBuffer_Release(&view);
+    }
+    else {
+        result = -1;
+    }
+    Py_DECREF(chunk);
+    if ((result == 0) && (length == 0)) {
+        self->is_eof = True;
+    }
+    return result;
+}
+
+// Checks that there's nothing but whitespace (and comments) after the
+// document, as decode() does, once its tape's been walked.
+static int
+path_check_rest(PathIteratorObject *self)
+{
+    JSONData *jsondata;
+    Py_UCS1 *ptr;
+    void *line_start;
+    long lineno;
+
+    if (self->stream == NULL) {
+        jsondata = &self->jsondata;
+        self->variant->skip_spaces(jsondata);
+    }
+    else {
+        jsondata = &self->stream->jsondata;
+        while (True) {
+            decoder_drop(self->stream);
+            ptr = jsondata->ptr;
+            lineno = jsondata->lineno;
+            line_start = jsondata->line_start;
+            self->variant->skip_spaces(jsondata);
+            if (self->is_eof
+                || ((Py_UCS1 *)jsondata->end - (Py_UCS1 *)jsondata->ptr > 1)
+            ) {
+                break;
+            }
+            // At the end, or at what might start a comment: it's skipped
+            // again once there's more (so a comment's not cut short).
+            jsondata->ptr = ptr;
+            jsondata->lineno = lineno;
+            jsondata->line_start = line_start;
+            if (path_read(self) == -1) {
+                return -1;
+            }
+        }
+    }
+    if (jsondata->ptr < jsondata->end) {
+        jsondata_fail(jsondata, Error_ExtraData, jsondata->ptr);
+        self->variant->raise_error(jsondata);
+        return -1;
+    }
+    return 0;
+}
+
+// Tokenizes the next tape's worth of input, from the file if it's being
+// read from one. Returns 0, or -1 with an exception set.
+static int
+path_tokenize(PathIteratorObject *self)
+{
+    DecoderObject *stream = self->stream;
+    JSONData *jsondata;
+    Py_UCS1 *ptr;
+    void *line_start;
+    long lineno;
+    Py_ssize_t n_frames;
+
+    if (stream == NULL) {
+        jsondata = &self->jsondata;
+        jsondata->tape_size = 0;
+        jsondata->tape_read = 0;
+        self->status = self->variant->tokenize_value(jsondata);
+        if (self->status == -1) {
+            self->variant->raise_error(jsondata);
+            return -1;
+        }
+        return 0;
+    }
+
+    // As for a Decoder, from a checkpoint: the tape's all been walked, so
+    // the input before it can go.
+    jsondata = &stream->jsondata;
+    jsondata->tape_size = 0;
+    jsondata->tape_read = 0;
+    decoder_drop(stream);
+    while (True) {
+        if (decoder_save(stream, &ptr, &lineno, &line_start) == -1) {
+            return -1;
+        }
+        n_frames = jsondata->tokenizing.size;
+        self->status = self->variant->tokenize_value(jsondata);
+        if (self->is_eof || !decoder_came_up_short(stream, self->status)) {
+            break;
+        }
+        decoder_restore(stream, ptr, lineno, line_start, n_frames);
+        if (path_read(self) == -1) {
+            return -1;
+        }
+    }
+    if (self->status == -1) {
+        self->variant->raise_error(jsondata);
+        return -1;
+    }
+    return 0;
+}
+
+// Walks the tape, down the path, until a value at the end of it has been
+// built (returning 1), or the tape's been used up (returning 0). Returns -1
+// with an exception set.
+static int
+path_walk(PathIteratorObject *self, JSONData *jsondata, PyObject **value)
+{
+    TapeEntry *entry;
+    PathLevel *level;
+    PathStep *step;
+    int type, is_match, result;
+
+    if (self->is_building) {
+        goto build;
+    }
+    while (jsondata->tape_read < jsondata->tape_size) {
+        entry = &jsondata->tape[jsondata->tape_read];
+        type = entry->type;
+
+        if (self->skipping > 0) {
+            // (Without looking inside it.)
+            if ((type == TAPE_ARRAY) || (type == TAPE_OBJECT)) {
+                self->skipping++;
+            }
+            else if ((type == TAPE_END_ARRAY) || (type == TAPE_END_OBJECT)) {
+                self->skipping--;
+            }
+            jsondata->tape_read++;
+            continue;
+        }
+
+        if ((type == TAPE_END_ARRAY) || (type == TAPE_END_OBJECT)) {
+            self->depth--;
+            jsondata->tape_read++;
+            continue;
+        }
+
+        if (type == TAPE_KEY) {
+            level = &self->levels[self->depth - 1];
+            step = &self->steps[self->depth - 1];
+            if (step->type == Step_Key) {
+                result = self->variant->match_key(jsondata, entry, step->key);
+                if (result == -1) {
+                    return -1;
+                }
+                level->is_match = result;
+            }
+            else {
+                level->is_match = (step->type == Step_Any);
+            }
+            jsondata->tape_read++;
+            continue;
+        }
+
+        // A value: is it on the path?
+        if (self->depth == 0) {
+            is_match = True;
+        }
+        else {
+            level = &self->levels[self->depth - 1];
+            step = &self->steps[self->depth - 1];
+            if (level->is_object) {
+                is_match = level->is_match;
+            }
+            else {
+                is_match = (step->type == Step_Any)
+                    || ((step->type == Step_Index) && (step->index == level->index));
+                level->index++;
+            }
+        }
+        if (is_match && (self->depth == self->n_steps)) {
+            self->is_building = True;
+            goto build;
+        }
+        if ((type == TAPE_ARRAY) || (type == TAPE_OBJECT)) {
+            if (is_match) {
+                level = &self->levels[self->depth++];
+                level->is_object = (type == TAPE_OBJECT);
+                level->index = 0;
+                level->is_match = False;
+            }
+            else {
+                self->skipping = 1;
+            }
+        }
+        jsondata->tape_read++;
+    }
+    return 0;
+
+build:
+    result = self->variant->build_value(jsondata, value);
+    if (result != 0) {
+        self->is_building = False;
+    }
+    return result;
+}
+
+// Iterate over the values at the path in a JSON document
+static PyObject *
+JSON_iter_path(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"input", "path", "strict", "max_depth", NULL};
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *input, *path;
+    PathIteratorObject *self;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "OU|in:iter_path", kwlist, &input, &path, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+
+    self = (PathIteratorObject *)PathIteratorType.tp_alloc(&PathIteratorType, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->status = 1;
+    if (path_parse(self, path) == -1) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->levels = PyMem_New(PathLevel, self->n_steps + 1);
+    if (self->levels == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+
+    if (PyObject_HasAttrString(input, "read")) {
+        Py_INCREF(input);
+        self->fileobj = input;
+        self->stream = (DecoderObject *)PyObject_CallFunction(
+            (PyObject *)&DecoderType, "in", strict, max_depth
+        );
+        if (self->stream == NULL) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        self->variant = self->stream->variant;
+    }
+    else {
+        if (source_open(&self->source, input) == -1) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        Py_INCREF(input);
+        self->json = input;
+        // (The tape's kept from one value to the next.)
+        if (source_freeze(&self->source, &self->json) == -1) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        self->variant = decoder_variant(self->source.kind, self->source.is_utf8, strict);
+        jsondata_init(
+            &self->jsondata, self->source.str, self->source.length, self->source.kind, max_depth
+        );
+        self->jsondata.tape_limit = TAPE_CHUNK;
+    }
+    return (PyObject *)self;
+}
+
+static void
+PathIterator_dealloc(PathIteratorObject *self)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < self->n_steps; i++) {
+        Py_XDECREF(self->steps[i].key);
+    }
+    PyMem_Free(self->steps);
+    PyMem_Free(self->levels);
+    if (self->json != NULL) {
+        jsondata_free(&self->jsondata);
+        source_close(&self->source);
+        Py_DECREF(self->json);
+    }
+    Py_XDECREF(self->stream);
+    Py_XDECREF(self->fileobj);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+PathIterator_next(PathIteratorObject *self)
+{
+    JSONData *jsondata = (self->stream != NULL) ? &self->stream->jsondata : &self->jsondata;
+    PyObject *value = NULL;
+    DecoderCache local_cache;
+    int result;
+
+    if (self->is_done) {
+        return NULL;
+    }
+    if (self->stream == NULL) {
+        jsondata_claim_cache(jsondata, &local_cache);
+    }
+    while (True) {
+        result = path_walk(self, jsondata, &value);
+        if (result != 0) {
+            break;
+        }
+        if (self->status == 0) {
+            // The whole document's been walked.
+            if (path_check_rest(self) == -1) {
+                result = -1;
+            }
+            break;
+        }
+        if (path_tokenize(self) == -1) {
+            result = -1;
+            break;
+        }
+    }
+    if (self->stream == NULL) {
+        jsondata_release_cache(jsondata, &local_cache);
+    }
+    if (result != 1) {
+        self->is_done = True;
+        return NULL;
+    }
+    return value;
+}
+
+static PyTypeObject PathIteratorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "chjson.PathIterator",
+    .tp_basicsize = sizeof(PathIteratorObject),
+    .tp_dealloc = (destructor)PathIterator_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)PathIterator_next,
+};
+
+// *** Events
+
+// parse_events()'s events: one per tape entry, in order.
+typedef enum {
+    Event_StartObject,
+    Event_EndObject,
+    Event_StartArray,
+    Event_EndArray,
+    Event_Key,
+    Event_Value,
+    N_EVENTS
+} EventType;
+
+static const char *event_names[N_EVENTS] = {
+    "start_object", "end_object", "start_array", "end_array", "key", "value"
+};
+
+// The names, interned (see MOD_INIT).
+static PyObject *event_strs[N_EVENTS];
+
+// Where the events go: the handler's methods (NULL for those it doesn't
+// have, whose events are skipped), or else a list of (event, value) pairs.
+typedef struct EventSink {
+    PyObject *methods[N_EVENTS];
+    PyObject *events;
+} EventSink;
+
+// Sends the event, with the value (or None, if it's NULL). Returns 0, or -1
+// with an exception set.
+static int
+event_emit(EventSink *sink, int event, PyObject *value)
+{
+    PyObject *item, *result;
+    int status;
+
+    if (sink->events != NULL) {
+        item = PyTuple_Pack(2, event_strs[event], (value != NULL) ? value : Py_None);
+        if (item == NULL) {
+            return -1;
+        }
+        status = PyList_Append(sink->events, item);
+        Py_DECREF(item);
+        return status;
+    }
+    // (start_ and end_ methods are called without an argument.)
+    result = PyObject_CallFunctionObjArgs(sink->methods[event], value, NULL);
+    if (result == NULL) {
+        return -1;
+    }
+    Py_DECREF(result);
+    return 0;
+}
+
+// Sends the events for the entries on the tape, building the keys and values
+// (but only if they're wanted). Returns 0, or -1 with an exception set.
+static int
+events_walk(EventSink *sink, const DecoderVariant *variant, JSONData *jsondata)
+{
+    TapeEntry *entry;
+    PyObject *value;
+    int event, result;
+
+    while (jsondata->tape_read < jsondata->tape_size) {
+        entry = &jsondata->tape[jsondata->tape_read];
+        switch (entry->type) {
+        case TAPE_OBJECT:
+            event = Event_StartObject;
+            break;
+        case TAPE_END_OBJECT:
+            event = Event_EndObject;
+            break;
+        case TAPE_ARRAY:
+            event = Event_StartArray;
+            break;
+        case TAPE_END_ARRAY:
+            event = Event_EndArray;
+            break;
+        case TAPE_KEY:
+            event = Event_Key;
+            break;
+        default:
+            event = Event_Value;
+            break;
+        }
+        if ((sink->events == NULL) && (sink->methods[event] == NULL)) {
+            jsondata->tape_read++;
+            continue;
+        }
+
+        value = NULL;
+        if (event == Event_Key) {
+            value = variant->build_key(jsondata, entry);
+            if (value == NULL) {
+                return -1;
+            }
+            jsondata->tape_read++;
+        }
+        else if (event == Event_Value) {
+            // (A scalar's built all at once, and the tape's read past it.)
+            if (variant->build_value(jsondata, &value) == -1) {
+                return -1;
+            }
+        }
+        else {
+            jsondata->tape_read++;
+        }
+        result = event_emit(sink, event, value);
+        Py_XDECREF(value);
+        if (result == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Parse a JSON representation into a stream of events
+static PyObject *
+JSON_parse_events(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "handler", "strict", "max_depth", NULL};
+    int strict = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *json, *handler = Py_None, *result = NULL;
+    EventSink sink;
+    Source source;
+    JSONData jsondata;
+    DecoderCache local_cache;
+    const DecoderVariant *variant;
+    int i, status;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|Oin:parse_events", kwlist, &json, &handler, &strict, &max_depth)
+    ) {
+        return NULL;
+    }
+
+    if (max_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+
+    memset(&sink, 0, sizeof(sink));
+    if (handler == Py_None) {
+        sink.events = PyList_New(0);
+        if (sink.events == NULL) {
+            return NULL;
+        }
+    }
+    else {
+        for (i = 0; i < N_EVENTS; i++) {
+            sink.methods[i] = PyObject_GetAttr(handler, event_strs[i]);
+            if (sink.methods[i] == NULL) {
+                if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                    goto done;
+                }
+                PyErr_Clear();
+            }
+        }
+    }
+
+    Py_INCREF(json);
+    if (source_open(&source, json) == -1) {
+        Py_DECREF(json);
+        goto done;
+    }
+    // (The handler's called between tokenizing and building.)
+    if ((sink.events == NULL) && (source_freeze(&source, &json) == -1)) {
+        source_close(&source);
+        Py_DECREF(json);
+        goto done;
+    }
+    variant = decoder_variant(source.kind, source.is_utf8, strict);
+    jsondata_init(&jsondata, source.str, source.length, source.kind, max_depth);
+
+    // As jsondata_build() does, but walking the tape rather than building
+    // from it.
+    jsondata_claim_cache(&jsondata, &local_cache);
+    status = jsondata_tokenize(&jsondata, variant->tokenize_document, source.is_mutable);
+    while (True) {
+        if (status == -1) {
+            variant->raise_error(&jsondata);
+            break;
+        }
+        if (events_walk(&sink, variant, &jsondata) == -1) {
+            break;
+        }
+        if (status == 0) {
+            if (sink.events != NULL) {
+                Py_INCREF(sink.events);
+                result = sink.events;
+            }
+            else {
+                Py_INCREF(Py_None);
+                result = Py_None;
+            }
+            break;
+        }
+        jsondata.tape_size = 0;
+        jsondata.tape_read = 0;
+        status = variant->tokenize_document(&jsondata);
+    }
+    jsondata_release_cache(&jsondata, &local_cache);
+    jsondata_free(&jsondata);
+    source_close(&source);
+    Py_DECREF(json);
+
+done:
+    for (i = 0; i < N_EVENTS; i++) {
+        Py_XDECREF(sink.methods[i]);
+    }
+    Py_XDECREF(sink.events);
+    return result;
+}
+
+static PyMethodDef chjson_methods[] = {
+    {
+        "encode",
         (PyCFunction)JSON_encode,
         METH_O,
         PyDoc_STR("encode(object) -> generate the JSON representation for object.")
@@ -3219,7 +6229,7 @@ static PyMethodDef chjson_methods[] = {
         (PyCFunction)JSON_decode,
         METH_VARARGS|METH_KEYWORDS,
         PyDoc_STR(
-            "decode(string, all_unicode=False, strict=False) -> \n"
+            "decode(string, all_unicode=False, strict=False, max_depth=1000) -> \n"
             "Parse the JSON representation into python objects.\n"
             "The optional argument, `all_unicode', specifies how to convert the \n"
             "strings in the JSON representation into python objects. If it is \n"
@@ -3232,6 +6242,138 @@ static PyMethodDef chjson_methods[] = {
             "comments, single-quote object keys (as opposed to require double- \n"
             "quotes, fractional numbers without a leading zero (like `.123'), \n"
             "and multi-line strings with or without line continuation characters.\n"
+            "The optional argument, `max_depth', limits how deeply arrays and \n"
+            "objects can be nested before DecodeError is raised.\n"
+            "The JSON representation can be a str, or UTF-8 encoded bytes or \n"
+            "any other object that supports the buffer protocol (such as a \n"
+            "bytearray, memoryview or mmap), which is parsed without a copy.\n"
+        )
+    },
+    {
+        "validate",
+        (PyCFunction)JSON_validate,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "validate(string, strict=False, max_depth=1000) -> \n"
+            "Check that the JSON representation parses (as for decode()), \n"
+            "and return None, or else raise the DecodeError that decode() would. \n"
+            "No python objects are built, and numbers aren't converted (though \n"
+            "an integer with more digits than int() converts fails, as it does \n"
+            "for decode()), and the GIL is released while the input's checked \n"
+            "(unless it's writable, like a bytearray).\n"
+        )
+    },
+    {
+        "raw_decode",
+        (PyCFunction)JSON_raw_decode,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "raw_decode(string, strict=False, max_depth=1000) -> \n"
+            "Parse the first JSON value in the representation (after any \n"
+            "whitespace or comments), and return a tuple of it and the offset \n"
+            "where it ends (in characters of a str, or bytes of a buffer), \n"
+            "ignoring whatever follows. The optional arguments are as for decode().\n"
+        )
+    },
+    {
+        "iterdecode",
+        (PyCFunction)JSON_iterdecode,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "iterdecode(string, strict=False, max_depth=1000) -> \n"
+            "Return an iterator over the stream of JSON values in the \n"
+            "representation (one after another, separated by whitespace or \n"
+            "comments, as in JSON Lines), which parses each in turn, as it's \n"
+            "asked for. The optional arguments are as for decode().\n"
+        )
+    },
+    {
+        "decode_file",
+        (PyCFunction)JSON_decode_file,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "decode_file(path, strict=False, max_depth=1000) -> \n"
+            "Parse the UTF-8 encoded JSON file at path into python objects.\n"
+            "The file is memory-mapped where possible, and read (or paged in) \n"
+            "without holding the GIL. The optional arguments are as for decode(), \n"
+            "and DecodeError messages start with the file's name. A file that's \n"
+            "rewritten while it's parsed raises DecodeError (or is parsed as it \n"
+            "is as it's read), but truncating it can kill the process (SIGBUS), \n"
+            "as with any memory-mapped file.\n"
+        )
+    },
+    {
+        "decode_many",
+        (PyCFunction)JSON_decode_many,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "decode_many(documents, threads=0, strict=False, max_depth=1000) -> \n"
+            "Parse each of a sequence of JSON representations (as for decode()) \n"
+            "into python objects, and return a list of them, in order. A document \n"
+            "that doesn't parse gets the DecodeError it raised in its place. \n"
+            "The documents are validated and tokenized in parallel, without the \n"
+            "GIL, on up to `threads' native threads (by default, and at most, \n"
+            "one per CPU, and no more than there are documents), and then the \n"
+            "objects are built, one document at a time.\n"
+        )
+    },
+    {
+        "decode_lines",
+        (PyCFunction)JSON_decode_lines,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "decode_lines(input, threads=0, strict=False, max_depth=1000) -> \n"
+            "Parse each line of a JSON Lines file (input is its path, or else \n"
+            "a buffer of UTF-8, such as bytes) into python objects, and return \n"
+            "a list of them, in order, skipping blank lines. The lines are \n"
+            "validated and tokenized in parallel, a window at a time, without \n"
+            "the GIL, on up to `threads' native threads (by default, and at \n"
+            "most, one per CPU). DecodeError messages give the line number in the file (and \n"
+            "start with its name). The other arguments are as for decode().\n"
+        )
+    },
+    {
+        "iterdecode_lines",
+        (PyCFunction)JSON_iterdecode_lines,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "iterdecode_lines(input, threads=0, strict=False, max_depth=1000) -> \n"
+            "Return an iterator over the values on the lines of a JSON Lines \n"
+            "file (or buffer), as for decode_lines(), which only keeps the \n"
+            "windows of lines being tokenized and built, whatever the file's size.\n"
+        )
+    },
+    {
+        "iter_path",
+        (PyCFunction)JSON_iter_path,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "iter_path(input, path, strict=False, max_depth=1000) -> \n"
+            "Return an iterator over the values at the path in the JSON \n"
+            "document, which is a str or buffer (as for decode()), or a file \n"
+            "object, which is read a chunk at a time. The path is like \n"
+            "`$.items[*]': `$' is the document, `.name' or `[\'name\']' an \n"
+            "object's member, `[n]' an array's item, and `.*' or `[*]' any \n"
+            "of them. Only the values at the path are built, one at a time, \n"
+            "and the rest of the document is skipped over without creating \n"
+            "any objects. The other arguments are as for decode().\n"
+        )
+    },
+    {
+        "parse_events",
+        (PyCFunction)JSON_parse_events,
+        METH_VARARGS|METH_KEYWORDS,
+        PyDoc_STR(
+            "parse_events(string, handler=None, strict=False, max_depth=1000) -> \n"
+            "Parse the JSON representation (as for decode()) into a stream of \n"
+            "events, without building its arrays and objects: start_object, \n"
+            "end_object, start_array and end_array, key (with the key) and \n"
+            "value (with a string, number, True, False or None). With a handler, \n"
+            "its methods of those names are called, in order (start_ and end_ \n"
+            "without an argument), and those it doesn't have are skipped. \n"
+            "Otherwise, a list of (event, value) tuples is returned, with None \n"
+            "for the value of start_ and end_ events. The other arguments are \n"
+            "as for decode().\n"
         )
     },
     {NULL, NULL}  // sentinel
@@ -3278,9 +6420,15 @@ module_cleanup(PyObject *m)
 MOD_INIT(chjson)
 {
     PyObject *m;
+    int i;
 
     MOD_DEF(m, "chjson", chjson_methods, module_doc);
 
+    #ifdef CHJSON_AVX2
+    __builtin_cpu_init();
+    have_avx2 = __builtin_cpu_supports("avx2") ? True : False;
+    #endif
+
     if (m == NULL) {
         return module_cleanup(NULL);
     }
@@ -3306,6 +6454,27 @@ MOD_INIT(chjson)
     Py_INCREF(JSON_DecodeError);
     PyModule_AddObject(m, "DecodeError", JSON_DecodeError);
 
+    if (PyType_Ready(&DecoderType) == -1) {
+        return module_cleanup(NULL);
+    }
+    Py_INCREF(&DecoderType);
+    PyModule_AddObject(m, "Decoder", (PyObject *)&DecoderType);
+    if (PyType_Ready(&DecodeIteratorType) == -1) {
+        return module_cleanup(NULL);
+    }
+    if (PyType_Ready(&LinesType) == -1) {
+        return module_cleanup(NULL);
+    }
+    if (PyType_Ready(&PathIteratorType) == -1) {
+        return module_cleanup(NULL);
+    }
+    for (i = 0; i < N_EVENTS; i++) {
+        event_strs[i] = PyUnicode_InternFromString(event_names[i]);
+        if (event_strs[i] == NULL) {
+            return module_cleanup(NULL);
+        }
+    }
+
     // Module version (the MODULE_VERSION macro is defined by setup.py)
     PyModule_AddStringConstant(m, "__version__", string(MODULE_VERSION));
 
@@ -0,0 +1,1669 @@
+// File: chjson_decode.h
+// Project Page: https://github.com/landonb/chjson
+// License: GPLv3
+// Description: The JSON decoder, as a template over the input's code units.
+// vim:tw=0:ts=4:sw=4:et
+
+// chjson.c includes this file once per PEP 393 kind, so that str input is
+// parsed in place, whatever its width, plus once for bytes input, which is
+// UTF-8; and for each of those, once per mode, so that strict decoding
+// doesn't pay for the loose syntax (and vice versa). Each variant tokenizes
+// its input onto a tape (phase 1, which doesn't need the GIL), and builds
+// values from the tape (phase 2), and is bundled up as a DecoderVariant.
+// Before including it, define:
+//
+//   JSON_KIND           1, 2 or 4: the PyUnicode kind (bytes per code unit).
+//   JSON_CHAR           Py_UCS1, Py_UCS2 or Py_UCS4, to match.
+//   JSON_KIND_FN(name)  the name of name's variant for this kind (for the
+//                       block scanners, which chjson.c defines).
+//   JSON_UTF8           1 if the (1-byte) code units are UTF-8, not Latin-1.
+//   JSON_STRICT         1 to follow the JSON spec. exactly, or 0 to be loose.
+//   JSON_FN(name)       the name of name's variant for this kind and mode.
+//
+// Everything is undefined again at the end of the file.
+
+// *** JSONData "class" methods.
+
+// Only the pointer moves: the offset (column) is worked out from the line's
+// start if there's an error to report (see JSON_OFFSET).
+static void
+JSON_FN(jsondata_mv_ptr)(JSONData *jsondata, Py_ssize_t n_chars)
+{
+    jsondata->ptr = JSON_PTR(jsondata) + n_chars;
+}
+
+// Encodes (up to) the next 20 characters at ptr as UTF-8, for error messages.
+static char *
+JSON_FN(snippet)(JSONData *jsondata, JSON_CHAR *ptr, char *buf)
+{
+    char *out = buf;
+    int n_chars;
+
+    #if JSON_UTF8
+    // Already UTF-8: copy the bytes (each character's, however many).
+    for (n_chars = 0; (ptr < JSON_END(jsondata)) && (out - buf < SNIPPET_SIZE - 1); ptr++) {
+        if ((*ptr == 0) || (((*ptr & 0xC0) != 0x80) && (++n_chars > SNIPPET_CHARS))) {
+            break;
+        }
+        *out++ = (char)*ptr;
+    }
+    #else
+    for (n_chars = 0; (n_chars < SNIPPET_CHARS) && (ptr < JSON_END(jsondata)); n_chars++) {
+        if (*ptr == 0) {
+            break;
+        }
+        out = write_utf8(out, *ptr++);
+    }
+    #endif
+    *out = '\0';
+    return buf;
+}
+
+// Returns True if the literal (which is len ASCII characters) is at ptr.
+static int
+JSON_FN(match_literal)(JSON_CHAR *ptr, JSON_CHAR *end, const char *literal, Py_ssize_t len)
+{
+    Py_ssize_t i;
+
+    if (end - ptr < len) {
+        return False;
+    }
+    for (i = 0; i < len; i++) {
+        if (ptr[i] != (unsigned char)literal[i]) {
+            return False;
+        }
+    }
+    return True;
+}
+
+// Skips whitespace (and, unless strict, comments), counting lines: a line
+// starts after each LF, CR, CR/LF or LF/CR. The line's start is remembered
+// in place of a running offset. Returns the code unit it stopped at (NUL
+// at the end of the input, or at a NUL in it, which callers tell apart by
+// whether jsondata->ptr is at the end).
+static Py_UCS4
+JSON_FN(skip_spaces)(JSONData *jsondata)
+{
+    int prev_ch_was_LF = False;
+    int prev_ch_was_CR = False;
+    #if !JSON_STRICT
+    int prev_ch_was_solidus = False;
+    int in_multiline_comment = False;
+    #endif
+
+    JSON_CHAR *ptr = JSON_PTR(jsondata);
+    Py_UCS4 ch = JSON_PEEK(ptr, JSON_END(jsondata));
+
+    // Most often (between tokens in minified input) there's nothing to skip.
+    if (!(CHAR_CLASS(ch) & (JSON_STRICT ? CC_SPACE : (CC_SPACE | CC_COMMENT)))) {
+        return ch;
+    }
+
+    while (True) {
+        if ((ch == ' ') || (ch == '\t')) {
+            // Indentation: skip the whole run of blanks a block at a time.
+            ptr = JSON_KIND_FN(skip_blanks)(ptr, JSON_END(jsondata));
+            prev_ch_was_CR = False;
+            prev_ch_was_LF = False;
+            ch = JSON_PEEK(ptr, JSON_END(jsondata));
+            continue;
+        }
+        else if (ch == '\0') {
+            break;
+        }
+        else if (JSON_ISSPACE(ch)) {
+            // https://en.wikipedia.org/wiki/Newline
+            if (!(CHAR_CLASS(ch) & CC_NEWLINE)) {
+                prev_ch_was_CR = False;
+                prev_ch_was_LF = False;
+            }
+            else if (ch == '\n') {
+                if (!prev_ch_was_CR) {
+                    jsondata->lineno++;
+                    jsondata->line_start = ptr;
+                    prev_ch_was_LF = True;
+                }
+                else {
+                    // lineno already incremented, but identify, e.g.,
+                    // \r\n\n\r as two lines. Not that that should ever happen.
+                    prev_ch_was_LF = False;
+                }
+                prev_ch_was_CR = False;
+            }
+            else if (ch == '\r') {
+                if (!prev_ch_was_LF) {
+                    jsondata->lineno++;
+                    jsondata->line_start = ptr;
+                    prev_ch_was_CR = True;
+                }
+                else {
+                    // lineno already incremented, but identify, e.g.,
+                    // \r\n\n\r as two lines. Not that that should ever happen.
+                    prev_ch_was_CR = False;
+                }
+                prev_ch_was_LF = False;
+            }
+        }
+        #if JSON_STRICT
+        else {
+            // MEH: We could see if there _is_ a comment following and
+            // add that as a hint to any error output, but whatever.
+            break;
+        }
+        #else
+        else {
+            if (in_multiline_comment) {
+                if (('*' == ch) && ('/' == JSON_PEEK(ptr + 1, JSON_END(jsondata)))) {
+                    ptr++;
+                    in_multiline_comment = False;
+                }
+                else {
+                    // Skip ahead to whatever might end the comment, or the
+                    // line (so the newline branch can count it).
+                    ptr = JSON_KIND_FN(scan_comment)(ptr + 1, JSON_END(jsondata), '*');
+                    prev_ch_was_CR = False;
+                    prev_ch_was_LF = False;
+                    ch = JSON_PEEK(ptr, JSON_END(jsondata));
+                    continue;
+                }
+            }
+            else if (ch == '/') {
+                // Whatever follows, a newline before the solidus doesn't
+                // pair up with one after it.
+                prev_ch_was_CR = False;
+                prev_ch_was_LF = False;
+                if (prev_ch_was_solidus) {
+                    // A single-line comment.
+                    ptr = JSON_KIND_FN(scan_comment)(ptr + 1, JSON_END(jsondata), '\n');
+                    ch = JSON_PEEK(ptr, JSON_END(jsondata));
+                    // Let newline do it.
+                    prev_ch_was_solidus = False;
+                    continue; // We already got the next ch.
+                }
+                else {
+                    prev_ch_was_solidus = True;
+                }
+            }
+            else if ((ch == '*') && (prev_ch_was_solidus)) {
+                // A multi-line comment.
+                in_multiline_comment = True;
+                prev_ch_was_solidus = False;
+            }
+            else {
+                if (prev_ch_was_solidus) {
+                    // Deconsume the sole slash.
+                    ptr--;
+                    ch = *ptr;
+                }
+                prev_ch_was_solidus = False;
+                break;
+            }
+        }
+        #endif
+
+        ptr++;
+        ch = JSON_PEEK(ptr, JSON_END(jsondata));
+    }
+
+    jsondata->ptr = ptr;
+    return ch;
+}
+
+// *** Errors
+
+// Raises the DecodeError for why tokenizing stopped (see jsondata_fail),
+// with the position and line that jsondata was left at.
+static void
+JSON_FN(raise_error)(JSONData *jsondata)
+{
+    char snippet[SNIPPET_SIZE];
+    const char *format;
+    PyObject *message;
+    Py_UCS4 c;
+
+    switch (jsondata->error) {
+    case Error_NoMemory:
+        PyErr_NoMemory();
+        return;
+    case Error_Null:
+    case Error_Bool:
+        PyErr_Format(
+            JSON_DecodeError,
+            (jsondata->error == Error_Null)
+                ? "cannot parse JSON description as null: \"%s\" (lineno %ld, offset %ld)"
+                : "cannot parse JSON description as bool: \"%s\" (lineno %ld, offset %ld)",
+            JSON_FN(snippet)(jsondata, JSON_PTR(jsondata), snippet),
+            jsondata->lineno, JSON_OFFSET(jsondata)
+        );
+        return;
+    case Error_Inf:
+    case Error_NaN:
+        PyErr_Format(
+            JSON_DecodeError,
+            (jsondata->error == Error_Inf)
+                ? "cannot parse JSON description as Inf.: %s (lineno %ld, offset %ld)"
+                : "cannot parse JSON description as NaN: %s (lineno %ld, offset %ld)",
+            JSON_FN(snippet)(jsondata, JSON_PTR(jsondata), snippet),
+            jsondata->lineno, JSON_OFFSET(jsondata)
+        );
+        return;
+    case Error_Empty:
+        PyErr_Format(
+            JSON_DecodeError,
+            "empty JSON description (lineno %ld, offset %ld)",
+            jsondata->lineno, JSON_OFFSET(jsondata)
+        );
+        return;
+    case Error_Token:
+        c = JSON_PEEK(JSON_PTR(jsondata), JSON_END(jsondata));
+        #if JSON_UTF8
+        if ((c >= 0x80) && (utf8_decode(JSON_PTR(jsondata), JSON_END(jsondata), &c) == 0)) {
+            c = 0xFFFD;
+        }
+        #endif
+        PyErr_Format(
+            JSON_DecodeError,
+            "cannot parse JSON description as token: \"%c\""
+                " (lineno %ld, offset %ld)",
+            (int)c, jsondata->lineno, JSON_OFFSET(jsondata)
+        );
+        return;
+    case Error_MaxDepth:
+        PyErr_Format(
+            JSON_DecodeError,
+            "maximum nesting depth of " SSIZE_T_F " exceeded at position " SSIZE_T_F
+                " (lineno %ld, offset %ld)",
+            jsondata->max_depth, JSON_POS(jsondata, jsondata->error_at),
+            jsondata->lineno, JSON_OFFSET(jsondata)
+        );
+        return;
+    }
+
+    // The rest say where, and then which line.
+    switch (jsondata->error) {
+    case Error_Number:
+        format = "invalid number starting at position " SSIZE_T_F;
+        break;
+    case Error_Escape:
+        format = "invalid string contains unrecognized backslash escape "
+            "starting at position " SSIZE_T_F;
+        break;
+    case Error_TruncatedEscape:
+        format = "cannot decode string starting at position " SSIZE_T_F
+            ": truncated \\uXXXX escape";
+        break;
+    case Error_UnterminatedString:
+        format = "unterminated string starting at position " SSIZE_T_F;
+        break;
+    case Error_Nul:
+        format = "invalid character '\\0' at position " SSIZE_T_F;
+        break;
+    case Error_StringNewline:
+        format = (!JSON_STRICT)
+            ? "invalid string contains newline (hint: use backslash escape continuator) "
+              "starting at position " SSIZE_T_F
+            : "invalid string contains newline starting at position " SSIZE_T_F;
+        break;
+    case Error_InvalidUTF8:
+        format = "cannot decode string starting at position " SSIZE_T_F ": invalid UTF-8";
+        break;
+    case Error_UnterminatedArray:
+        format = "unterminated array starting at position " SSIZE_T_F;
+        break;
+    case Error_UnterminatedObject:
+        format = "unterminated object starting at position " SSIZE_T_F;
+        break;
+    case Error_ArrayItem:
+        format = "expecting array item at position " SSIZE_T_F;
+        break;
+    case Error_ArrayComma:
+        format = "expecting ',' or ']' at position " SSIZE_T_F;
+        break;
+    case Error_PropertyName:
+        format = "expecting object property name at position " SSIZE_T_F;
+        break;
+    case Error_PropertyNameAfterComma:
+        format = "expecting object property name rather than trailing comma "
+            "at position " SSIZE_T_F;
+        break;
+    case Error_Colon:
+        format = "missing colon after object property name at position " SSIZE_T_F;
+        break;
+    case Error_PropertyValue:
+        format = "expecting object property value at position " SSIZE_T_F;
+        break;
+    case Error_ObjectComma:
+        format = "expecting ',' or '}' at position " SSIZE_T_F;
+        break;
+    case Error_ExtraData:
+        format = "extra data after JSON description at position " SSIZE_T_F;
+        break;
+    default:
+        PyErr_SetString(PyExc_SystemError, "chjson: unknown decode error");
+        return;
+    }
+
+    message = PyUnicode_FromFormat(format, JSON_POS(jsondata, jsondata->error_at));
+    if (message == NULL) {
+        return;
+    }
+    PyErr_Format(
+        JSON_DecodeError, "%U (lineno %ld, offset %ld)",
+        message, jsondata->lineno, JSON_OFFSET(jsondata)
+    );
+    Py_DECREF(message);
+}
+
+// *** Strings
+
+static long
+JSON_FN(decode_hex4)(JSON_CHAR *ptr, JSON_CHAR *end)
+{
+    long value = 0;
+    int i;
+    Py_UCS4 c;
+
+    if (end - ptr < 4) {
+        return -1;
+    }
+    for (i = 0; i < 4; i++) {
+        c = ptr[i];
+        value <<= 4;
+        if ((c >= '0') && (c <= '9')) {
+            value |= c - '0';
+        }
+        else if ((c >= 'a') && (c <= 'f')) {
+            value |= c - 'a' + 10;
+        }
+        else if ((c >= 'A') && (c <= 'F')) {
+            value |= c - 'A' + 10;
+        }
+        else {
+            return -1;
+        }
+    }
+    return value;
+}
+
+// Decodes the \uXXXX escape at ptr (which points at the 'u'), combining
+// it with a following \uXXXX low surrogate if it's a high surrogate.
+// Returns the code point, or -1 if the escape is truncated, and sets
+// *n_chars to the number of characters consumed.
+static long
+JSON_FN(decode_unicode_escape)(JSON_CHAR *ptr, JSON_CHAR *end, int *n_chars)
+{
+    long value, low;
+
+    value = JSON_FN(decode_hex4)(ptr + 1, end);
+    *n_chars = 5;
+    if ((value >= 0xD800) && (value <= 0xDBFF)
+        && (end - ptr >= 11) && (ptr[5] == '\\') && (ptr[6] == 'u')
+    ) {
+        low = JSON_FN(decode_hex4)(ptr + 7, end);
+        if ((low >= 0xDC00) && (low <= 0xDFFF)) {
+            value = 0x10000 + (((value - 0xD800) << 10) | (low - 0xDC00));
+            *n_chars = 11;
+        }
+    }
+    return value;
+}
+
+// Validates the string literal at jsondata->ptr and finds its closing
+// quote, its decoded length, and the largest code point it contains.
+// Doesn't need the GIL.
+static int
+JSON_FN(measure_string)(JSONData *jsondata, StringInfo *info)
+{
+    JSON_CHAR *ptr, *run_end;
+    JSON_CHAR quote_delim;
+    Py_UCS4 c;
+    long value;
+    int n_chars;
+    Py_ssize_t length;
+    Py_UCS4 maxchar, stop_at;
+    int has_escapes, bad_unicode_escape;
+
+    quote_delim = (JSON_STRICT) ? '"' : (*JSON_PTR(jsondata)); // " or '
+
+    length = 0;
+    maxchar = 0x7F;
+    stop_at = STRING_STOP_AT(maxchar);
+    has_escapes = bad_unicode_escape = False;
+    ptr = JSON_PTR(jsondata) + 1;
+    while (True) {
+        // Jump over ordinary characters, many at a time. Once a character
+        // has been seen, characters that are no wider needn't stop the scan.
+        run_end = JSON_KIND_FN(scan_string)(ptr, JSON_END(jsondata), quote_delim, stop_at);
+        length += run_end - ptr;
+        ptr = run_end;
+
+        c = JSON_PEEK(ptr, JSON_END(jsondata));
+        if (c == quote_delim) {
+            break;
+        }
+        else if (c == '\\') {
+            has_escapes = True;
+            c = JSON_PEEK(ptr + 1, JSON_END(jsondata));
+            switch (c) {
+            case 'u':
+                value = JSON_FN(decode_unicode_escape)(ptr + 1, JSON_END(jsondata), &n_chars);
+                if (value < 0) {
+                    // Report it once the rest of the string checks out.
+                    bad_unicode_escape = True;
+                    ptr += 2;
+                    break;
+                }
+                if ((Py_UCS4)value > maxchar) {
+                    maxchar = (Py_UCS4)value;
+                    stop_at = STRING_STOP_AT(maxchar);
+                }
+                length++;
+                ptr += 1 + n_chars;
+                break;
+            case 'r':
+            case 'n':
+            case 't':
+            case 'b':
+            case 'f':
+            case '\\':
+            // The json spec. allows escaping forward slashes, e.g., \/
+            // which helps when embedding JSON in a <script> tag, which
+            // doesn't allow </ inside strings.
+            case '/':
+                length++;
+                ptr += 2;
+                break;
+            case '\0':
+                // Let the loop report the unterminated string.
+                ptr++;
+                break;
+            // [lb] added this: the original cjson supports multi-line
+            // quoted strings, which the json standard does not support
+            // (so this was missing). We could let it slide, but Python's
+            // demjson allows multi-line quoted strings using trailing
+            // slash line continuation indicators -- which is also standard
+            // in other languages, like Bash -- so we should follow convention.
+            // The continuation is dropped but the newline (and the other
+            // half of a CR/LF or LF/CR pair) is kept.
+            case '\n':
+            case '\r':
+                if (!JSON_STRICT) {
+                    length++;
+                    ptr += 2;
+                    if (((c == '\n') && (JSON_PEEK(ptr, JSON_END(jsondata)) == '\r'))
+                        || ((c == '\r') && (JSON_PEEK(ptr, JSON_END(jsondata)) == '\n'))
+                    ) {
+                        length++;
+                        ptr++;
+                    }
+                    break;
+                }
+                // fall through
+            default:
+                // chjson: Escaping the quote that delimits the string.
+                if (c == quote_delim) {
+                    length++;
+                    ptr += 2;
+                    break;
+                }
+                return jsondata_fail(jsondata, Error_Escape, JSON_PTR(jsondata));
+            }
+        }
+        else if (c == 0) {
+            if (ptr < JSON_END(jsondata)) {
+                jsondata->ptr = ptr;
+                return jsondata_fail(jsondata, Error_Nul, ptr);
+            }
+            return jsondata_fail(jsondata, Error_UnterminatedString, JSON_PTR(jsondata));
+        }
+        else if ((c == '\n') || (c == '\r')) {
+            return jsondata_fail(jsondata, Error_StringNewline, JSON_PTR(jsondata));
+        }
+        #if JSON_UTF8
+        else if (c >= 0x80) {
+            // Check the whole run of multibyte sequences, each of which
+            // counts as one character.
+            ptr = (JSON_CHAR *)utf8_measure(ptr, JSON_END(jsondata), &length, &maxchar);
+            if (ptr == NULL) {
+                return jsondata_fail(jsondata, Error_InvalidUTF8, JSON_PTR(jsondata));
+            }
+        }
+        #endif
+        else {
+            // Another control character, which we let slide, or a character
+            // wider than any seen so far.
+            if (c > maxchar) {
+                maxchar = c;
+                stop_at = STRING_STOP_AT(maxchar);
+            }
+            length++;
+            ptr++;
+        }
+    }
+
+    if (bad_unicode_escape) {
+        return jsondata_fail(jsondata, Error_TruncatedEscape, JSON_PTR(jsondata));
+    }
+
+    info->body = JSON_PTR(jsondata) + 1;
+    info->close = ptr;
+    info->length = length;
+    info->maxchar = maxchar;
+    info->has_escapes = has_escapes;
+
+    return 0;
+}
+
+// Writes the decoded string described by info straight into a new compact
+// unicode object, sized and kinded by measure_string(). (Which it checks,
+// rather than trusts, since a buffer can change after it's been measured:
+// see utf8_write().)
+static PyObject *
+JSON_FN(build_string)(StringInfo *info)
+{
+    PyObject *object;
+    int kind;
+    void *data;
+    JSON_CHAR *ptr, *close;
+    Py_ssize_t i;
+    long value;
+    int n_chars;
+    Py_UCS4 ch;
+    #if JSON_KIND == 1
+    JSON_CHAR *run_end;
+    #endif
+    #if JSON_UTF8
+    Py_UCS1 *out, bits;
+    #endif
+    Py_UCS4 widest;
+
+    object = PyUnicode_New(info->length, info->maxchar);
+    if (object == NULL) {
+        return NULL;
+    }
+    kind = PyUnicode_KIND(object);
+    data = PyUnicode_DATA(object);
+    // The widest character the object can take. (maxchar is only as exact
+    // as it needs to be to pick the kind, see STRING_STOP_AT.)
+    widest = (info->maxchar < 0x80) ? 0x7F
+        : (kind == PyUnicode_1BYTE_KIND) ? 0xFF
+        : (kind == PyUnicode_2BYTE_KIND) ? 0xFFFF
+        : 0x10FFFF;
+
+    if ((!info->has_escapes) && (kind == JSON_KIND) && ((!JSON_UTF8) || (info->maxchar < 0x80))) {
+        #if JSON_UTF8
+        // (Checking that it's still ASCII.)
+        ptr = info->body;
+        out = (Py_UCS1 *)data;
+        bits = 0;
+        for (i = 0; i < info->length; i++) {
+            bits |= ptr[i];
+            out[i] = ptr[i];
+        }
+        if (bits >= 0x80) {
+            goto changed;
+        }
+        #else
+        memcpy(data, info->body, info->length * JSON_KIND);
+        #endif
+        return object;
+    }
+
+    i = 0;
+    ptr = info->body;
+    close = info->close;
+    while (ptr < close) {
+        #if JSON_UTF8
+        // Decode everything up to the next escape in one go. (A backslash
+        // can't be part of a multibyte sequence.)
+        run_end = memchr(ptr, '\\', close - ptr);
+        if (run_end == NULL) {
+            run_end = close;
+        }
+        i = utf8_write(ptr, run_end, kind, data, i, info->length, info->maxchar);
+        if (i == -1) {
+            goto changed;
+        }
+        ptr = run_end;
+        if (ptr == close) {
+            break;
+        }
+        #elif JSON_KIND == 1
+        if (kind == PyUnicode_1BYTE_KIND) {
+            // Copy everything up to the next escape in one go.
+            run_end = memchr(ptr, '\\', close - ptr);
+            if (run_end == NULL) {
+                run_end = close;
+            }
+            if (run_end - ptr > info->length - i) {
+                goto changed;
+            }
+            memcpy((Py_UCS1 *)data + i, ptr, run_end - ptr);
+            i += run_end - ptr;
+            ptr = run_end;
+            if (ptr == close) {
+                break;
+            }
+        }
+        else
+        #endif
+        if (*ptr != '\\') {
+            if ((i >= info->length) || ((Py_UCS4)*ptr > widest)) {
+                goto changed;
+            }
+            PyUnicode_WRITE(kind, data, i++, *ptr);
+            ptr++;
+            continue;
+        }
+        // An escape, which measure_string() already validated.
+        switch (ptr[1]) {
+        case 'b':
+            ch = '\b';
+            break;
+        case 'f':
+            ch = '\f';
+            break;
+        case 'n':
+            ch = '\n';
+            break;
+        case 'r':
+            ch = '\r';
+            break;
+        case 't':
+            ch = '\t';
+            break;
+        case 'u':
+            value = JSON_FN(decode_unicode_escape)(ptr + 1, close, &n_chars);
+            if ((value < 0) || ((Py_UCS4)value > widest) || (i >= info->length)) {
+                goto changed;
+            }
+            PyUnicode_WRITE(kind, data, i++, (Py_UCS4)value);
+            ptr += 1 + n_chars;
+            continue;
+        default:
+            // A backslash, solidus, quote, or line continuation newline.
+            ch = ptr[1];
+            break;
+        }
+        if ((i >= info->length) || (ch > widest)) {
+            goto changed;
+        }
+        PyUnicode_WRITE(kind, data, i++, ch);
+        ptr += 2;
+    }
+    if (i != info->length) {
+        goto changed;
+    }
+    return object;
+
+changed:
+    Py_DECREF(object);
+    return string_changed();
+}
+
+// Returns True if the str key holds the code units at ptr.
+static int
+JSON_FN(key_equals)(PyObject *key, JSON_CHAR *ptr, Py_ssize_t length)
+{
+    int kind;
+    void *data;
+    Py_ssize_t i;
+
+    if (PyUnicode_GET_LENGTH(key) != length) {
+        return False;
+    }
+    kind = PyUnicode_KIND(key);
+    data = PyUnicode_DATA(key);
+    if (kind == JSON_KIND) {
+        return memcmp(data, ptr, length * JSON_KIND) == 0;
+    }
+    for (i = 0; i < length; i++) {
+        if (PyUnicode_READ(kind, data, i) != ptr[i]) {
+            return False;
+        }
+    }
+    return True;
+}
+
+// Like build_string(), for object keys, which come from the key cache when
+// they've been seen before. If the key is expected (the next one in the
+// object's shape) it's checked against that first.
+static PyObject *
+JSON_FN(build_key)(JSONData *jsondata, StringInfo *info, PyObject *expected)
+{
+    PyObject *key, **slot;
+    KeyCache *key_cache = &jsondata->cache->keys;
+    JSON_CHAR *ptr, *close;
+    size_t hash, probe, index;
+
+    // (Keys are cached by their code units, which in UTF-8 are only the
+    // code points if they're ASCII.)
+    if (info->has_escapes || (info->length > KEY_CACHE_MAX_LENGTH)
+        || ((JSON_UTF8) && (info->maxchar >= 0x80))
+    ) {
+        return JSON_FN(build_string)(info);
+    }
+
+    if ((expected != NULL) && JSON_FN(key_equals)(expected, info->body, info->length)) {
+        Py_INCREF(expected);
+        return expected;
+    }
+
+    // FNV-1a, over code points, so it doesn't matter how wide the input is.
+    ptr = info->body;
+    close = info->close;
+    hash = 2166136261U;
+    for (; ptr < close; ptr++) {
+        hash = (hash ^ *ptr) * 16777619;
+    }
+
+    slot = NULL;
+    for (probe = 0; probe < KEY_CACHE_PROBES; probe++) {
+        index = (hash + probe) & (KEY_CACHE_SIZE - 1);
+        key = key_cache->keys[index];
+        if (key == NULL) {
+            slot = &key_cache->keys[index];
+            break;
+        }
+        if ((key_cache->hashes[index] == hash)
+            && JSON_FN(key_equals)(key, info->body, info->length)
+        ) {
+            Py_INCREF(key);
+            return key;
+        }
+    }
+    if (slot == NULL) {
+        // All taken: evict the first candidate.
+        index = hash & (KEY_CACHE_SIZE - 1);
+        slot = &key_cache->keys[index];
+        Py_CLEAR(*slot);
+    }
+
+    key = JSON_FN(build_string)(info);
+    if (key == NULL) {
+        return NULL;
+    }
+    PyUnicode_InternInPlace(&key);
+    Py_INCREF(key);
+    *slot = key;
+    key_cache->hashes[slot - key_cache->keys] = hash;
+
+    return key;
+}
+
+// *** Numbers
+
+// Returns a pointer to the first code unit at or after ptr that isn't a
+// digit (or end, if there is none).
+static JSON_CHAR *
+JSON_FN(skip_digits)(JSON_CHAR *ptr, JSON_CHAR *end)
+{
+    #if (JSON_KIND == 1) && PY_LITTLE_ENDIAN && defined(chjson_ctz64)
+    unsigned long long word, others;
+
+    while (end - ptr >= 8) {
+        memcpy(&word, ptr, 8);
+        others = swar_nondigits(word);
+        if (others != 0) {
+            return ptr + (chjson_ctz64(others) >> 3);
+        }
+        ptr += 8;
+    }
+    #endif
+    while ((ptr < end) && JSON_ISDIGIT(*ptr)) {
+        ptr++;
+    }
+    return ptr;
+}
+
+// Returns the value of the n_digits (at most MAX_INT_DIGITS) digits at ptr.
+static unsigned long long
+JSON_FN(parse_digits)(JSON_CHAR *ptr, Py_ssize_t n_digits)
+{
+    unsigned long long value = 0;
+    JSON_CHAR *end = ptr + n_digits;
+
+    #if (JSON_KIND == 1) && PY_LITTLE_ENDIAN
+    while (end - ptr >= 8) {
+        value = value * 100000000 + parse_eight_digits(ptr);
+        ptr += 8;
+    }
+    #endif
+    while (ptr < end) {
+        value = value * 10 + (*ptr++ - '0');
+    }
+    return value;
+}
+
+// Tries to convert the (validated) float at ptr, which ends at end, without
+// any rounding error, returning False if it's not one that can be done fast.
+static int
+JSON_FN(parse_float_fast)(JSON_CHAR *ptr, JSON_CHAR *end, double *result)
+{
+    #ifdef CHJSON_FAST_FLOAT
+    unsigned long long mantissa = 0;
+    int n_digits = 0;
+    long exp10 = 0, exponent = 0;
+    int is_negative = False, exp_negative = False;
+    double value;
+
+    if ((*ptr == '-') || (*ptr == '+')) {
+        is_negative = (*ptr++ == '-');
+    }
+    // Leading zeros aren't significant; any other digit counts, and there
+    // can only be as many as fit (a few more might, but it's not worth it).
+    for (; (ptr < end) && JSON_ISDIGIT(*ptr); ptr++) {
+        if ((mantissa == 0) && (*ptr == '0')) {
+            continue;
+        }
+        if (++n_digits > MAX_INT_DIGITS) {
+            return False;
+        }
+        mantissa = mantissa * 10 + (*ptr - '0');
+    }
+    if ((ptr < end) && (*ptr == '.')) {
+        for (ptr++; (ptr < end) && JSON_ISDIGIT(*ptr); ptr++) {
+            exp10--;
+            if ((mantissa == 0) && (*ptr == '0')) {
+                continue;
+            }
+            if (++n_digits > MAX_INT_DIGITS) {
+                return False;
+            }
+            mantissa = mantissa * 10 + (*ptr - '0');
+        }
+    }
+    if (ptr < end) {
+        // The exponent: 'e' or 'E', maybe a sign, then digits.
+        ptr++;
+        if ((*ptr == '-') || (*ptr == '+')) {
+            exp_negative = (*ptr++ == '-');
+        }
+        for (; ptr < end; ptr++) {
+            if (exponent < 100000) {
+                exponent = exponent * 10 + (*ptr - '0');
+            }
+        }
+        exp10 += exp_negative ? -exponent : exponent;
+    }
+
+    if (mantissa == 0) {
+        *result = is_negative ? -0.0 : 0.0;
+        return True;
+    }
+    if (mantissa > MAX_EXACT_MANTISSA) {
+        return False;
+    }
+    if ((exp10 > MAX_EXACT_POW10) && (exp10 <= MAX_EXACT_POW10 + 15)) {
+        // E.g., 12e30: shift the excess into the mantissa, if it stays exact.
+        for (; exp10 > MAX_EXACT_POW10; exp10--) {
+            mantissa *= 10;
+            if (mantissa > MAX_EXACT_MANTISSA) {
+                return False;
+            }
+        }
+    }
+    if ((exp10 < -MAX_EXACT_POW10) || (exp10 > MAX_EXACT_POW10)) {
+        return False;
+    }
+
+    value = (double)mantissa;
+    if (exp10 < 0) {
+        value /= exact_pow10[-exp10];
+    }
+    else {
+        value *= exact_pow10[exp10];
+    }
+    *result = is_negative ? -value : value;
+    return True;
+    #else
+    return False;
+    #endif
+}
+
+// Converts the (validated) float at ptr, which ends at end.
+static PyObject *
+JSON_FN(parse_float)(JSON_CHAR *ptr, JSON_CHAR *end)
+{
+    double value;
+    char stack_buf[FLOAT_BUF_SIZE];
+    char *buf = stack_buf;
+    Py_ssize_t i, length = end - ptr;
+
+    if (JSON_FN(parse_float_fast)(ptr, end, &value)) {
+        return PyFloat_FromDouble(value);
+    }
+
+    // Otherwise, it's Python's correctly rounded strtod, which wants chars.
+    if (length >= FLOAT_BUF_SIZE) {
+        buf = PyMem_Malloc(length + 1);
+        if (buf == NULL) {
+            return PyErr_NoMemory();
+        }
+    }
+    for (i = 0; i < length; i++) {
+        buf[i] = (char)ptr[i];
+    }
+    buf[length] = '\0';
+    value = PyOS_string_to_double(buf, NULL, NULL);
+    if (buf != stack_buf) {
+        PyMem_Free(buf);
+    }
+    if ((value == -1.0) && PyErr_Occurred()) {
+        return NULL;
+    }
+    return PyFloat_FromDouble(value);
+}
+
+// Finds the end of the number at ptr (an int, int frac, int exp, or int frac
+// exp, maybe signed), or returns NULL if it isn't one. Sets *is_float if it
+// has a fraction or an exponent.
+static JSON_CHAR *
+JSON_FN(scan_number)(JSON_CHAR *ptr, JSON_CHAR *end, int *is_float)
+{
+    Py_UCS4 c;
+
+    *is_float = False;
+    if (*ptr == '-' || *ptr == '+') {
+        ptr++;
+    }
+
+    // Start with the first character.
+    c = JSON_PEEK(ptr, end);
+    if (c == '0') {
+        ptr++;
+        // Hmm. Per JSON spec. it's wrong to have digits after a leading '0'.
+        if (JSON_ISDIGIT(JSON_PEEK(ptr, end))) {
+            return NULL;
+        }
+    }
+    else if (JSON_ISDIGIT(c)) {
+        ptr = JSON_FN(skip_digits)(ptr, end);
+    }
+    // chjson: leading '0' digit not required.
+    else if ((c == '.') && (!JSON_STRICT)) {
+        ; // We'll handle this next.
+    }
+    else {
+        return NULL;
+    }
+
+    if (JSON_PEEK(ptr, end) == '.') {
+       *is_float = True;
+       ptr++;
+       if (!JSON_ISDIGIT(JSON_PEEK(ptr, end))) {
+           return NULL;
+       }
+       ptr = JSON_FN(skip_digits)(ptr, end);
+    }
+
+    c = JSON_PEEK(ptr, end);
+    if (c == 'e' || c == 'E') {
+       *is_float = True;
+       ptr++;
+       c = JSON_PEEK(ptr, end);
+       if (c == '+' || c == '-') {
+           ptr++;
+       }
+       if (!JSON_ISDIGIT(JSON_PEEK(ptr, end))) {
+           return NULL;
+       }
+       ptr = JSON_FN(skip_digits)(ptr, end);
+    }
+
+    return ptr;
+}
+
+// *** Tokenizing (phase 1)
+//
+// None of this touches a Python object (or raises), so it can be run with
+// the GIL released. A failure is recorded with jsondata_fail(), for
+// raise_error() to raise.
+
+// The offset of p, for the tape.
+#define TAPE_OFFSET(jsondata, p) ((Py_ssize_t)((JSON_CHAR *)(p) - JSON_STR(jsondata)))
+
+// Appends the literal at jsondata->ptr, which should be the given one, to
+// the tape as type; or fails with error.
+static int
+JSON_FN(tokenize_literal)(
+    JSONData *jsondata, const char *literal, Py_ssize_t len, int type, int error
+) {
+    TapeEntry *entry;
+
+    if (!JSON_FN(match_literal)(JSON_PTR(jsondata), JSON_END(jsondata), literal, len)) {
+        return jsondata_fail(jsondata, error, JSON_PTR(jsondata));
+    }
+    entry = tape_push(jsondata);
+    if (entry == NULL) {
+        return jsondata_fail(jsondata, Error_NoMemory, JSON_PTR(jsondata));
+    }
+    entry->type = type;
+    entry->start = TAPE_OFFSET(jsondata, JSON_PTR(jsondata));
+    JSON_FN(jsondata_mv_ptr)(jsondata, len);
+    return 0;
+}
+
+// Appends Infinity, +Infinity, -Infinity or NaN to the tape, as a float.
+static int
+JSON_FN(tokenize_special)(JSONData *jsondata, double value, Py_ssize_t len)
+{
+    TapeEntry *entry;
+
+    entry = tape_push(jsondata);
+    if (entry == NULL) {
+        return jsondata_fail(jsondata, Error_NoMemory, JSON_PTR(jsondata));
+    }
+    entry->type = TAPE_FLOAT;
+    entry->start = TAPE_OFFSET(jsondata, JSON_PTR(jsondata));
+    entry->u.real = value;
+    JSON_FN(jsondata_mv_ptr)(jsondata, len);
+    return 0;
+}
+
+static int
+JSON_FN(tokenize_inf)(JSONData *jsondata)
+{
+    JSON_CHAR *ptr = JSON_PTR(jsondata), *end = JSON_END(jsondata);
+
+    if (JSON_FN(match_literal)(ptr, end, "Infinity", 8)) {
+        return JSON_FN(tokenize_special)(jsondata, INFINITY, 8);
+    }
+    else if (JSON_FN(match_literal)(ptr, end, "+Infinity", 9)) {
+        return JSON_FN(tokenize_special)(jsondata, INFINITY, 9);
+    }
+    else if (JSON_FN(match_literal)(ptr, end, "-Infinity", 9)) {
+        return JSON_FN(tokenize_special)(jsondata, -INFINITY, 9);
+    }
+    return jsondata_fail(jsondata, Error_Inf, ptr);
+}
+
+// Appends the string at jsondata->ptr to the tape as type (TAPE_STRING or
+// TAPE_KEY).
+static int
+JSON_FN(tokenize_string)(JSONData *jsondata, int type)
+{
+    StringInfo info;
+    TapeEntry *entry;
+
+    if (JSON_FN(measure_string)(jsondata, &info) == -1) {
+        return -1;
+    }
+    entry = tape_push(jsondata);
+    if (entry == NULL) {
+        return jsondata_fail(jsondata, Error_NoMemory, JSON_PTR(jsondata));
+    }
+    entry->type = type;
+    entry->has_escapes = info.has_escapes;
+    entry->maxchar = info.maxchar;
+    entry->start = TAPE_OFFSET(jsondata, info.body);
+    entry->u.string.close = TAPE_OFFSET(jsondata, info.close);
+    entry->u.string.length = info.length;
+    jsondata->ptr = (JSON_CHAR *)info.close + 1;
+    return 0;
+}
+
+// Appends the number at jsondata->ptr to the tape, already converted if
+// that can be done without Python.
+static int
+JSON_FN(tokenize_number)(JSONData *jsondata)
+{
+    TapeEntry *entry;
+    JSON_CHAR *start, *ptr, *digits;
+    int is_float, is_negative;
+    unsigned long long value;
+
+    start = JSON_PTR(jsondata);
+    ptr = JSON_FN(scan_number)(start, JSON_END(jsondata), &is_float);
+    if (ptr == NULL) {
+        return jsondata_fail(jsondata, Error_Number, start);
+    }
+    digits = ((*start == '-') || (*start == '+')) ? start + 1 : start;
+    if (
+        jsondata->is_validating
+        && (!is_float)
+        && (ptr - digits > jsondata->max_int_digits)
+    ) {
+        return jsondata_fail(jsondata, Error_Number, start);
+    }
+    entry = tape_push(jsondata);
+    if (entry == NULL) {
+        return jsondata_fail(jsondata, Error_NoMemory, start);
+    }
+    entry->start = TAPE_OFFSET(jsondata, start);
+    if (jsondata->is_validating) {
+        entry->type = TAPE_NUMBER;
+        jsondata->ptr = ptr;
+        return 0;
+    }
+
+    is_negative = (*start == '-');
+    if (is_float) {
+        if (JSON_FN(parse_float_fast)(start, ptr, &entry->u.real)) {
+            entry->type = TAPE_FLOAT;
+            jsondata->ptr = ptr;
+            return 0;
+        }
+    }
+    // Most integers fit in a long long, so skip the generic conversion;
+    // only those that overflow it are left to Python.
+    else if (
+        (ptr - digits <= MAX_INT_DIGITS)
+        && (
+            ((value = JSON_FN(parse_digits)(digits, ptr - digits))
+                <= (unsigned long long)PY_LLONG_MAX)
+            || (is_negative && (value == (unsigned long long)PY_LLONG_MAX + 1))
+        )
+    ) {
+        entry->type = TAPE_INTEGER;
+        if (!is_negative) {
+            entry->u.integer = (long long)value;
+        }
+        else if (value > (unsigned long long)PY_LLONG_MAX) {
+            entry->u.integer = PY_LLONG_MIN;
+        }
+        else {
+            entry->u.integer = -(long long)value;
+        }
+        jsondata->ptr = ptr;
+        return 0;
+    }
+
+    entry->type = TAPE_NUMBER;
+    entry->u.number.line_start = TAPE_OFFSET(jsondata, jsondata->line_start);
+    entry->u.number.lineno = jsondata->lineno;
+    jsondata->ptr = ptr;
+    return 0;
+}
+
+// Appends the scalar (anything but an array or object) that starts with c.
+static int
+JSON_FN(tokenize_scalar)(JSONData *jsondata, Py_UCS4 c)
+{
+    int cls = CHAR_CLASS(c);
+
+    if (cls & CC_QUOTE) {
+        // chjson loose quotes: single-quoted strings OK
+        if ((c == '"') || (!JSON_STRICT)) {
+            return JSON_FN(tokenize_string)(jsondata, TAPE_STRING);
+        }
+    }
+    else if (cls & CC_NUMBER) {
+        if (((c == '+') || (c == '-')) && (JSON_PEEK(JSON_PTR(jsondata) + 1, JSON_END(jsondata)) == 'I')) {
+            return JSON_FN(tokenize_inf)(jsondata);
+        }
+        return JSON_FN(tokenize_number)(jsondata);
+    }
+    else {
+        switch (c) {
+        case 0:
+            return jsondata_fail(
+                jsondata,
+                (JSON_PTR(jsondata) < JSON_END(jsondata)) ? Error_Nul : Error_Empty,
+                JSON_PTR(jsondata)
+            );
+        case 't':
+            return JSON_FN(tokenize_literal)(jsondata, "true", 4, TAPE_TRUE, Error_Bool);
+        case 'f':
+            return JSON_FN(tokenize_literal)(jsondata, "false", 5, TAPE_FALSE, Error_Bool);
+        case 'n':
+            return JSON_FN(tokenize_literal)(jsondata, "null", 4, TAPE_NULL, Error_Null);
+        case 'N':
+            if (JSON_FN(match_literal)(JSON_PTR(jsondata), JSON_END(jsondata), "NaN", 3)) {
+                return JSON_FN(tokenize_special)(jsondata, NAN, 3);
+            }
+            return jsondata_fail(jsondata, Error_NaN, JSON_PTR(jsondata));
+        case 'I':
+            return JSON_FN(tokenize_inf)(jsondata);
+        }
+    }
+
+    return jsondata_fail(jsondata, Error_Token, JSON_PTR(jsondata));
+}
+
+// Appends the next JSON value to the tape. Arrays and objects don't recurse:
+// each one being tokenized has a Frame on jsondata->tokenizing, which
+// remembers what's next. So once the tape's as long as tape_limit, this can
+// pause after any value in an array or object (returning 1), and resume
+// where it left off when it's called again.
+static int
+JSON_FN(tokenize_value)(JSONData *jsondata)
+{
+    TapeEntry *entry;
+    Frame *frame;
+    FrameStack *stack = &jsondata->tokenizing;
+    Py_UCS4 c;
+
+    if (stack->size > 0) {
+        goto next_in_container;
+    }
+
+next_value:
+    c = JSON_FN(skip_spaces)(jsondata);
+
+    if ((CHAR_CLASS(c) & CC_STRUCTURAL) && ((c == '[') || (c == '{'))) {
+        if (stack->size >= jsondata->max_depth) {
+            jsondata_fail(jsondata, Error_MaxDepth, JSON_PTR(jsondata));
+            goto failure;
+        }
+        frame = frame_push(stack);
+        entry = tape_push(jsondata);
+        if ((frame == NULL) || (entry == NULL)) {
+            jsondata_fail(jsondata, Error_NoMemory, JSON_PTR(jsondata));
+            goto failure;
+        }
+        frame->start = jsondata->ptr;
+        entry->start = TAPE_OFFSET(jsondata, JSON_PTR(jsondata));
+        if (c == '[') {
+            entry->type = TAPE_ARRAY;
+            frame->is_object = False;
+            frame->state = ArrayItem_or_ClosingBracket;
+        }
+        else {
+            entry->type = TAPE_OBJECT;
+            frame->is_object = True;
+            frame->state = DictionaryKey_or_ClosingBrace;
+            frame->trailing_comma = False;
+        }
+        JSON_FN(jsondata_mv_ptr)(jsondata, 1);
+        goto next_in_container;
+    }
+
+    if (JSON_FN(tokenize_scalar)(jsondata, c) == -1) {
+        goto failure;
+    }
+
+got_value:
+    if (stack->size == 0) {
+        return 0;
+    }
+    frame = &stack->frames[stack->size - 1];
+    if (frame->is_object) {
+        frame->state = Comma_or_ClosingBrace;
+    }
+    else {
+        frame->state = Comma_or_ClosingBracket;
+    }
+    // (Not at the end, where a number might yet go on, see Decoder.)
+    if ((jsondata->tape_size >= jsondata->tape_limit) && (JSON_PTR(jsondata) < JSON_END(jsondata))) {
+        return 1;
+    }
+
+next_in_container:
+    frame = &stack->frames[stack->size - 1];
+    c = JSON_FN(skip_spaces)(jsondata);
+    if (c == 0) {
+        if (JSON_PTR(jsondata) < JSON_END(jsondata)) {
+            jsondata_fail(jsondata, Error_Nul, JSON_PTR(jsondata));
+        }
+        else {
+            jsondata_fail(
+                jsondata,
+                (frame->is_object) ? Error_UnterminatedObject : Error_UnterminatedArray,
+                frame->start
+            );
+        }
+        goto failure;
+    }
+
+    if (!frame->is_object) {
+        switch (frame->state) {
+        case ArrayItem_or_ClosingBracket:
+            if (c == ']') {
+                goto close_container;
+            }
+        case ArrayItem:
+            if ((c == ',') || (c == ']')) {
+                jsondata_fail(jsondata, Error_ArrayItem, JSON_PTR(jsondata));
+                goto failure;
+            }
+            goto next_value;
+        case Comma_or_ClosingBracket:
+            if (c == ']') {
+                goto close_container;
+            }
+            else if (c == ',') {
+                JSON_FN(jsondata_mv_ptr)(jsondata, 1);
+                if (JSON_STRICT) {
+                    frame->state = ArrayItem;
+                }
+                else {
+                    // chjson: Allow trailing comma.
+                    frame->state = ArrayItem_or_ClosingBracket;
+                }
+                goto next_in_container;
+            }
+            jsondata_fail(jsondata, Error_ArrayComma, JSON_PTR(jsondata));
+            goto failure;
+        }
+    }
+
+    switch (frame->state) {
+    case DictionaryKey_or_ClosingBrace:
+        if (c == '}') {
+            goto close_container;
+        }
+    case DictionaryKey:
+        // OC:
+        //  if (c != '"') {
+        // chjson loose quotes:
+        if ((c != '"') && ((JSON_STRICT) || (c != '\''))) {
+            // MAYBE: Make a real Python exception type class.
+            // For now, when you catch the exception in Python, the dict is parts of
+            // args, e.g., catch JSON_DecodeError as e can be accessed e.args[0]['offset'].
+            jsondata_fail(
+                jsondata,
+                (frame->trailing_comma) ? Error_PropertyNameAfterComma : Error_PropertyName,
+                JSON_PTR(jsondata)
+            );
+            goto failure;
+        }
+        frame->trailing_comma = False;
+
+        if (JSON_FN(tokenize_string)(jsondata, TAPE_KEY) == -1) {
+            goto failure;
+        }
+
+        c = JSON_FN(skip_spaces)(jsondata);
+        if (c != ':') {
+            jsondata_fail(
+                jsondata,
+                ((c == 0) && (JSON_PTR(jsondata) < JSON_END(jsondata))) ? Error_Nul : Error_Colon,
+                JSON_PTR(jsondata)
+            );
+            goto failure;
+        }
+        JSON_FN(jsondata_mv_ptr)(jsondata, 1);
+
+        c = JSON_FN(skip_spaces)(jsondata);
+        if ((c == ',') || (c == '}')) {
+            jsondata_fail(jsondata, Error_PropertyValue, JSON_PTR(jsondata));
+            goto failure;
+        }
+        goto next_value;
+    case Comma_or_ClosingBrace:
+        frame->trailing_comma = False;
+        if (c == '}') {
+            goto close_container;
+        }
+        else if (c == ',') {
+            JSON_FN(jsondata_mv_ptr)(jsondata, 1);
+            if (JSON_STRICT) {
+                frame->state = DictionaryKey;
+            }
+            else {
+                // chjson: Allow trailing comma.
+                frame->state = DictionaryKey_or_ClosingBrace;
+            }
+            frame->trailing_comma = True;
+            goto next_in_container;
+        }
+        jsondata_fail(jsondata, Error_ObjectComma, JSON_PTR(jsondata));
+        goto failure;
+    }
+
+close_container:
+    entry = tape_push(jsondata);
+    if (entry == NULL) {
+        jsondata_fail(jsondata, Error_NoMemory, JSON_PTR(jsondata));
+        goto failure;
+    }
+    entry->type = (frame->is_object) ? TAPE_END_OBJECT : TAPE_END_ARRAY;
+    entry->start = TAPE_OFFSET(jsondata, JSON_PTR(jsondata));
+    JSON_FN(jsondata_mv_ptr)(jsondata, 1);
+    stack->size--;
+    goto got_value;
+
+failure:
+    stack->size = 0;
+    return -1;
+}
+
+// Tokenizes the one JSON value that should make up the whole input (which
+// can pause, like tokenize_value).
+static int
+JSON_FN(tokenize_document)(JSONData *jsondata)
+{
+    int status = JSON_FN(tokenize_value)(jsondata);
+
+    if (status != 0) {
+        return status;
+    }
+    if (JSON_FN(skip_spaces)(jsondata) == 0) {
+        if (JSON_PTR(jsondata) < JSON_END(jsondata)) {
+            return jsondata_fail(jsondata, Error_Nul, JSON_PTR(jsondata));
+        }
+        return 0;
+    }
+    return jsondata_fail(jsondata, Error_ExtraData, JSON_PTR(jsondata));
+    return 0;
+}
+
+// *** Building (phase 2)
+
+// Where the string at the tape entry is, for build_string().
+static void
+JSON_FN(string_info)(JSONData *jsondata, TapeEntry *entry, StringInfo *info)
+{
+    info->body = JSON_STR(jsondata) + entry->start;
+    info->close = JSON_STR(jsondata) + entry->u.string.close;
+    info->length = entry->u.string.length;
+    info->maxchar = entry->maxchar;
+    info->has_escapes = entry->has_escapes;
+}
+
+// Returns True if the (TAPE_KEY) tape entry's key is key, a str, or -1 with
+// an exception set. It's only built if it has to be.
+static int
+JSON_FN(match_key)(JSONData *jsondata, TapeEntry *entry, PyObject *key)
+{
+    StringInfo info;
+    PyObject *string;
+    int result;
+
+    JSON_FN(string_info)(jsondata, entry, &info);
+    if (info.length != PyUnicode_GET_LENGTH(key)) {
+        return False;
+    }
+    if ((!info.has_escapes) && ((!JSON_UTF8) || (info.maxchar < 0x80))) {
+        return JSON_FN(key_equals)(key, info.body, info.length);
+    }
+    string = JSON_FN(build_string)(&info);
+    if (string == NULL) {
+        return -1;
+    }
+    result = PyObject_RichCompareBool(string, key, Py_EQ);
+    Py_DECREF(string);
+    return result;
+}
+
+// Builds the (TAPE_KEY) tape entry's key, from the key cache if it's been
+// seen before.
+static PyObject *
+JSON_FN(build_tape_key)(JSONData *jsondata, TapeEntry *entry)
+{
+    StringInfo info;
+
+    JSON_FN(string_info)(jsondata, entry, &info);
+    return JSON_FN(build_key)(jsondata, &info, NULL);
+}
+
+// Converts the number at the (TAPE_NUMBER) tape entry, which tokenizing
+// left for Python: a big integer, or a float that needs correct rounding.
+static PyObject *
+JSON_FN(build_number)(JSONData *jsondata, TapeEntry *entry)
+{
+    PyObject *object, *str;
+    JSON_CHAR *start, *ptr;
+    int is_float;
+
+    start = JSON_STR(jsondata) + entry->start;
+    ptr = JSON_FN(scan_number)(start, JSON_END(jsondata), &is_float);
+    if (ptr == NULL) {
+        // (It's changed since it was tokenized.)
+        object = NULL;
+    }
+    else if (is_float) {
+        object = JSON_FN(parse_float)(start, ptr);
+    }
+    else {
+        str = PyUnicode_FromKindAndData(JSON_KIND, start, ptr - start);
+        if (str == NULL) {
+            return NULL;
+        }
+        object = PyLong_FromUnicodeObject(str, 10);
+        Py_DECREF(str);
+    }
+
+    if (object == NULL) {
+        // E.g., more digits than Python converts: report it where it is.
+        jsondata->ptr = start;
+        jsondata->lineno = entry->u.number.lineno;
+        jsondata->line_start = JSON_STR(jsondata) + entry->u.number.line_start;
+        jsondata_fail(jsondata, Error_Number, start);
+        JSON_FN(raise_error)(jsondata);
+    }
+    return object;
+}
+
+// Builds the next value on the tape, starting at tape_read, which it moves
+// past it. Arrays and objects don't recurse: each one being built has a
+// Frame on jsondata->building, and its items (or keys and values) pile up
+// on the scratch stack until its end, when its list (or dict) is made and
+// handed to the frame below as a finished value. If the tape runs out first
+// (because tokenizing paused), they're left for the next call to finish.
+static int
+JSON_FN(build_value)(JSONData *jsondata, PyObject **value)
+{
+    PyObject *object, *expected;
+    TapeEntry *entry;
+    StringInfo info;
+    Frame *frame;
+    FrameStack *stack = &jsondata->building;
+    Shape *shape;
+    Py_ssize_t i;
+
+    for (i = jsondata->tape_read; i < jsondata->tape_size; ) {
+        entry = &jsondata->tape[i++];
+        switch (entry->type) {
+        case TAPE_ARRAY:
+        case TAPE_OBJECT:
+            frame = frame_push(stack);
+            if (frame == NULL) {
+                PyErr_NoMemory();
+                goto failure;
+            }
+            frame->base = jsondata->scratch_size;
+            frame->is_object = (entry->type == TAPE_OBJECT);
+            if (frame->is_object) {
+                frame->n_keys = 0;
+                // The keys might be the same as the last object's at this depth.
+                shape = NULL;
+                if (stack->size <= SHAPE_MAX_DEPTH) {
+                    shape = &jsondata->cache->shapes[stack->size - 1];
+                }
+                frame->shape = shape;
+                frame->in_shape = (shape != NULL) && (shape->keys != NULL);
+            }
+            continue;
+        case TAPE_KEY:
+            frame = &stack->frames[stack->size - 1];
+            expected = NULL;
+            if (frame->in_shape && (frame->n_keys < PyTuple_GET_SIZE(frame->shape->keys))) {
+                expected = PyTuple_GET_ITEM(frame->shape->keys, frame->n_keys);
+            }
+            JSON_FN(string_info)(jsondata, entry, &info);
+            object = JSON_FN(build_key)(jsondata, &info, expected);
+            if (object == NULL) {
+                goto failure;
+            }
+            frame->in_shape = frame->in_shape && (object == expected);
+            frame->n_keys++;
+            if (scratch_push(jsondata, object) == -1) {
+                goto failure;
+            }
+            continue;
+        case TAPE_END_ARRAY:
+            frame = &stack->frames[stack->size - 1];
+            object = scratch_pop_list(jsondata, frame->base);
+            if (object == NULL) {
+                goto failure;
+            }
+            stack->size--;
+            break;
+        case TAPE_END_OBJECT:
+            frame = &stack->frames[stack->size - 1];
+            object = scratch_pop_dict(jsondata, frame->base, frame->shape, frame->in_shape);
+            if (object == NULL) {
+                goto failure;
+            }
+            stack->size--;
+            break;
+        case TAPE_STRING:
+            JSON_FN(string_info)(jsondata, entry, &info);
+            object = JSON_FN(build_string)(&info);
+            break;
+        case TAPE_INTEGER:
+            object = PyLong_FromLongLong(entry->u.integer);
+            break;
+        case TAPE_FLOAT:
+            object = PyFloat_FromDouble(entry->u.real);
+            break;
+        case TAPE_NUMBER:
+            object = JSON_FN(build_number)(jsondata, entry);
+            break;
+        case TAPE_TRUE:
+            object = Py_True;
+            Py_INCREF(object);
+            break;
+        case TAPE_FALSE:
+            object = Py_False;
+            Py_INCREF(object);
+            break;
+        default:
+            object = Py_None;
+            Py_INCREF(object);
+            break;
+        }
+
+        if (object == NULL) {
+            goto failure;
+        }
+        if (stack->size == 0) {
+            jsondata->tape_read = i;
+            *value = object;
+            return 1;
+        }
+        if (scratch_push(jsondata, object) == -1) {
+            goto failure;
+        }
+    }
+
+    jsondata->tape_read = i;
+    return 0;
+
+failure:
+    // (Whatever's on the scratch stack is dropped with jsondata.)
+    stack->size = 0;
+    return -1;
+}
+
+#undef TAPE_OFFSET
+
+// The variant, for decode_buffer() and friends to pick.
+static const DecoderVariant JSON_FN(variant) = {
+    JSON_FN(tokenize_value),
+    JSON_FN(tokenize_document),
+    JSON_FN(skip_spaces),
+    JSON_FN(raise_error),
+    JSON_FN(build_value),
+    JSON_FN(match_key),
+    JSON_FN(build_tape_key),
+};
+
+#undef JSON_KIND
+#undef JSON_CHAR
+#undef JSON_KIND_FN
+#undef JSON_UTF8
+#undef JSON_STRICT
+#undef JSON_FN
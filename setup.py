@@ -28,7 +28,8 @@ setup(
         "Topic :: Software Development :: Libraries :: Python Modules"
     ],
     ext_modules = [
-        Extension(name='chjson', sources=['chjson.c'], define_macros=macros)
+        Extension(name='chjson', sources=['chjson.c'], depends=['chjson_decode.h'],
+                  define_macros=macros)
     ]
 )
 
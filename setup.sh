@@ -52,7 +52,7 @@ build_for_py() {
     popd &> /dev/null
 }
 
-for pyexe in python2 python3; do
+for pyexe in python3; do
     build_for_py $pyexe
 done
 
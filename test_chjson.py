@@ -24,7 +24,12 @@
 import os
 import sys
 
+import io
 import itertools
+import json
+import mmap
+import tempfile
+import threading
 import unittest
 
 import chjson
@@ -399,16 +404,17 @@ class JsonTest(unittest.TestCase):
         self.assertEqual({"a–b": 123}, obj)
 
     def testObjectWithUuencodedEmDashAndTrailingCommaAndComment(self):
-        obj = chjson.decode('{"a\–b":123,} // nothing')
-        # FIXME/EXPLAIN: Is chjson really decoding this correctly? Seems weird.
-        self.assertEqual({"a\\u2013b": 123}, obj)
+        # A backslash before a non-ASCII character is an unrecognized escape,
+        # like a backslash before any other character that isn't an escape.
+        self.assertRaises(chjson.DecodeError, chjson.decode, '{"a\–b":123,} // nothing')
 
     def testObjectWithBackslashAndEmDashAndTrailingCommaAndMLComment(self):
-        obj = chjson.decode('{"a\\–b":123,} /* nothing   */ \r\n')
         # NOTE: Because of how \ works, sometimes \ and \\ are the same:
         #       The string that Python reads and passes to chjson interprets
         #       \ and \\ as the same: just one backslash.
-        self.assertEqual({'a\\u2013b': 123}, obj)
+        self.assertRaises(
+            chjson.DecodeError, chjson.decode, '{"a\\–b":123,} /* nothing   */ \r\n'
+        )
 
     def testObjectWithBackslashAndEndOfString(self):
         self.assertRaises(chjson.DecodeError, self._testObjectWithBackslashAndEndOfString)
@@ -558,6 +564,651 @@ class JsonTest(unittest.TestCase):
     def _testSingleLineCommentAndLineContinuation_2(self):
         obj = chjson.decode('{"SQL Statement": "SELECT foo; -- A comment. \rSELECT bar;",}')
 
+    def testDecodeLongIndentation(self):
+        # Runs of blanks longer than a scan block, and ones that end
+        # mid-block, on either side of newlines.
+        for width in (1, 7, 15, 16, 17, 31, 32, 33, 64, 100):
+            src = '[\n%s1,\r\n%s2,\t%s3%s]' % (
+                ' ' * width, '\t' * width, ' \t' * width, ' ' * width,
+            )
+            self.assertEqual([1, 2, 3], chjson.decode(src))
+            self.assertEqual([1, 2, 3], chjson.decode(src, strict=True))
+
+    def testDecodeLongIndentationErrorPosition(self):
+        try:
+            chjson.decode('[\n' + ' ' * 40 + 'x]')
+        except chjson.DecodeError as e:
+            self.assertEqual(
+                'cannot parse JSON description as token: "x" (lineno 2, offset 41)',
+                e.args[0],
+            )
+        else:
+            self.fail('expected DecodeError')
+
+    def testDecodeLongStrings(self):
+        # Quotes, escapes and non-ASCII characters at every offset of
+        # a string that spans several scan blocks.
+        plain = 'abcdefghijklmnopqrstuvwxyz0123456789' * 2
+        for i in range(len(plain) + 1):
+            head, tail = plain[:i], plain[i:]
+            self.assertEqual(plain, chjson.decode('"%s%s"' % (head, tail)))
+            self.assertEqual(head + '"' + tail, chjson.decode('"%s\\"%s"' % (head, tail)))
+            self.assertEqual(head + "'" + tail, chjson.decode("'%s\\'%s'" % (head, tail)))
+            self.assertEqual(head + '\u20ac' + tail, chjson.decode('"%s\u20ac%s"' % (head, tail)))
+            self.assertEqual(head + '\t' + tail, chjson.decode('"%s\\t%s"' % (head, tail)))
+            self.assertRaises(
+                chjson.DecodeError, chjson.decode, '"%s\n%s"' % (head, tail)
+            )
+            self.assertRaises(chjson.DecodeError, chjson.decode, '"%s' % (head,))
+
+    def testDecodeSurrogatePairEscape(self):
+        self.assertEqual(u'\U0001F600', chjson.decode(r'"\ud83d\ude00"'))
+        self.assertEqual(u'a\U0001F600b', chjson.decode(r'"a\uD83D\uDE00b"'))
+        # Unpaired surrogates are passed through as-is.
+        self.assertEqual(u'\ud83d', chjson.decode(r'"\ud83d"'))
+        self.assertEqual(u'\ud83dA', chjson.decode(r'"\ud83d\u0041"'))
+        self.assertEqual(u'\ude00', chjson.decode(r'"\ude00"'))
+
+    def testDecodeEscapesIntoWideStrings(self):
+        # Escapes mixed with characters that need 2- and 4-byte storage.
+        self.assertEqual(u'\u20ac\n\t"/\\', chjson.decode(r'"\u20ac\n\t\"\/\\"'))
+        self.assertEqual(
+            u'\U0001F600\u20ac\r\nx',
+            chjson.decode('"\\ud83d\\ude00\\u20ac\\\r\nx"'),
+        )
+        self.assertEqual(u'\xe9\u0100', chjson.decode(b'"\xc3\xa9\\u0100"'))
+
+    def testDecodeTruncatedUnicodeEscape(self):
+        for src in (r'"\u12"', r'"\u12', r'"\uXYZW"', r'["\u00e"]'):
+            self.assertRaises(chjson.DecodeError, chjson.decode, src)
+
+    def testDecodeWideStrInput(self):
+        # str input is parsed as is, whatever its width.
+        doc = '{"ascii": "abc", "latin": "café", "cjk": "東京", "emoji": "😀"}'
+        expected = {"ascii": "abc", "latin": "café", "cjk": "東京", "emoji": "😀"}
+        self.assertEqual(expected, chjson.decode(doc))
+        self.assertEqual(expected, chjson.decode(doc, strict=True))
+        self.assertEqual(["東京", 1.5, None], chjson.decode('[ "東京", 1.5, null ]'))
+
+    def testDecodeWideStrEscapes(self):
+        self.assertEqual("東\n😀é", chjson.decode('"東\\n\\ud83d\\ude00\\u00e9"'))
+        self.assertEqual("😀東", chjson.decode('"😀\\u6771"'))
+
+    def testDecodeWideStrErrorPosition(self):
+        # Positions count characters, not bytes.
+        try:
+            chjson.decode('["東京", "😀", x]')
+            self.fail("expected a DecodeError")
+        except chjson.DecodeError as err:
+            self.assertEqual('cannot parse JSON description as token: "x" (lineno 1, offset 12)', str(err))
+        try:
+            chjson.decode('["東京"] nul')
+            self.fail("expected a DecodeError")
+        except chjson.DecodeError as err:
+            self.assertEqual('extra data after JSON description at position 7 (lineno 1, offset 7)', str(err))
+
+    def testDecodeIntegers(self):
+        for text in (
+            "0", "-0", "+7", "12345678", "-123456789012345678",
+            "9223372036854775807", "-9223372036854775808",
+            # These overflow a long long.
+            "9223372036854775808", "-9223372036854775809",
+            "9999999999999999999", "123456789012345678901234567890",
+        ):
+            self.assertEqual(int(text), chjson.decode(text))
+            self.assertEqual([int(text)], chjson.decode("[" + text + "]"))
+            self.assertEqual([int(text), "\u0100"], chjson.decode("[" + text + ", \"\u0100\"]"))
+
+    def testDecodeIntegerArray(self):
+        values = [(i * 7919) % 100003 - 50000 for i in range(1000)]
+        self.assertEqual(values, chjson.decode(repr(values)))
+
+    def testDecodeFloats(self):
+        for text in (
+            "0.0", "-0.0", "1.5", "-122.419416", "37.774929", "1e22", "1e23",
+            "12e30", "0.1", "0.30000000000000004", "9007199254740993.0",
+            "1.7976931348623157e308", "4.9e-324", "2.2250738585072011e-308",
+            "1e400", "-1e400", "1e-400", "0e99999999999", "1E+2",
+            "123456789012345678901234567890.5", "0.000000000000000000000000123",
+        ):
+            self.assertEqual(float(text), chjson.decode(text))
+            self.assertEqual(repr(float(text)), repr(chjson.decode("[" + text + "]")[0]))
+            self.assertEqual(float(text), chjson.decode("[" + text + ", \"\u0100\"]")[0])
+
+    def testDecodeFloatsRoundTrip(self):
+        values = [((i * 7919) % 100003) / 977.0 - 50.0 for i in range(1000)]
+        values += [value * 1e-300 for value in values[:100]]
+        self.assertEqual(values, chjson.decode(repr(values)))
+
+    def testDecodeFloatsWithoutLeadingZero(self):
+        self.assertEqual([0.5, -0.25, 5.0], chjson.decode("[.5, -.25, +.5e1]"))
+        self.assertRaises(chjson.DecodeError, chjson.decode, ".5", strict=True)
+
+    def testDecodeRepeatedKeysAreShared(self):
+        records = chjson.decode('[{"id": 1, "name": "a"}, {"id": 2, "name": "b"}, {"name": "c", "id": 3}]')
+        keys = [sorted(record.keys()) for record in records]
+        self.assertEqual([["id", "name"]] * 3, keys)
+        for other in keys[1:]:
+            self.assertIs(keys[0][0], other[0])
+            self.assertIs(keys[0][1], other[1])
+
+    def testDecodeManyDistinctKeys(self):
+        # More keys than the key cache holds, with escapes, wide characters
+        # and long keys in the mix.
+        expected = {}
+        for i in range(2000):
+            expected["k%d" % (i,)] = i
+            expected["\u00e9\u6771%d" % (i % 50,)] = i
+            expected["x" * 100 + str(i % 10)] = i
+            expected["tab\t%d" % (i % 10,)] = i
+        records = [expected, expected]
+        for doc in (json.dumps(records), json.dumps(records, ensure_ascii=False)):
+            self.assertEqual(records, chjson.decode(doc))
+
+    def testDecodeLargeNestedArrays(self):
+        inner = list(range(100))
+        values = [[inner, [], [[i]], "s%d" % (i,)] for i in range(1000)]
+        decoded = chjson.decode(json.dumps(values))
+        self.assertEqual(values, decoded)
+        self.assertEqual(list(range(10 ** 5)), chjson.decode(json.dumps(list(range(10 ** 5)))))
+
+    def testDecodeArrayErrorAfterItems(self):
+        self.assertRaises(chjson.DecodeError, chjson.decode, '[[1, 2, [3, 4], "a"], [5, 6 7]]')
+        self.assertRaises(chjson.DecodeError, chjson.decode, '[1, 2, [3, 4, {"a": [5, x]}]]')
+        self.assertEqual([[1, [2]], 3], chjson.decode('[[1, [2]], 3]'))
+
+    def testDecodeObjectsOfVaryingShapes(self):
+        records = [
+            {"a": 1, "b": 2, "c": 3},
+            {"a": 4, "b": 5, "c": 6},
+            {"c": 7, "b": 8, "a": 9},
+            {"a": 10, "b": 11},
+            {"a": 12, "b": 13, "c": 14, "d": 15},
+            {"x": {"a": 1, "b": 2, "c": 3}, "y": []},
+            {"x": {"a": 1, "b": 2, "c": 3}, "z": {}},
+            {},
+            {"a": 16, "b": 17, "c": 18},
+        ]
+        doc = json.dumps(records)
+        self.assertEqual(records, chjson.decode(doc))
+        decoded = chjson.decode(doc)
+        self.assertEqual(records, decoded)
+        self.assertEqual([list(record) for record in records], [list(record) for record in decoded])
+
+    def testDecodeObjectsWithDuplicateKeysInShape(self):
+        doc = '[{"a": 1, "a": 2, "b": 3}, {"a": 4, "a": 5, "b": 6}, {"a": 7, "b": 8}]'
+        self.assertEqual([{"a": 2, "b": 3}, {"a": 5, "b": 6}, {"a": 7, "b": 8}], chjson.decode(doc))
+
+    def testDecodeDeeplyNestedObjects(self):
+        doc = {"leaf": True}
+        for i in range(50):
+            doc = {"level": i, "child": doc, "siblings": [{"level": i}]}
+        self.assertEqual(doc, chjson.decode(json.dumps(doc)))
+
+    def testDecodeObjectErrorAfterItems(self):
+        doc = '[{"a": 1, "b": 2}, {"a": 1, "b": [1, 2, {"c": x}]}]'
+        for _ in range(3):
+            self.assertRaises(chjson.DecodeError, chjson.decode, doc)
+        self.assertEqual([{"a": 1, "b": [1]}], chjson.decode('[{"a": 1, "b": [1]}]'))
+
+    def testDecodeErrorLinenoAndOffset(self):
+        # Newlines in strings don't count, and CR/LF counts once (but
+        # the offset that follows it includes the LF).
+        for doc, message in (
+            ('[1,\r\n  2,\r\n  x]',
+                'cannot parse JSON description as token: "x" (lineno 3, offset 4)'),
+            ('{\n  // note\n  "a": 1,\n  /* multi\n line */ "b": ?}',
+                'cannot parse JSON description as token: "?" (lineno 5, offset 15)'),
+            ('[1,\n\r\n\r 2 3]',
+                "expecting ',' or ']' at position 10 (lineno 3, offset 5)"),
+            ('"a\\\nb" x',
+                'extra data after JSON description at position 7 (lineno 1, offset 7)'),
+        ):
+            try:
+                chjson.decode(doc)
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                self.assertEqual(message, str(err))
+
+    def testDecodeMaxDepth(self):
+        self.assertEqual([[[1]]], chjson.decode('[[[1]]]', max_depth=3))
+        self.assertEqual({"a": [{"b": {}}]}, chjson.decode('{"a": [{"b": {}}]}', max_depth=4))
+        try:
+            chjson.decode('[[[1]]]', max_depth=2)
+            self.fail("expected a DecodeError")
+        except chjson.DecodeError as err:
+            self.assertEqual(
+                'maximum nesting depth of 2 exceeded at position 2 (lineno 1, offset 2)', str(err)
+            )
+        self.assertRaises(chjson.DecodeError, chjson.decode, '{"a": ' * 1001 + '1' + '}' * 1001)
+        self.assertRaises(ValueError, chjson.decode, '[1]', max_depth=0)
+
+    def testDecodeVeryDeepNesting(self):
+        # Deep input can't overflow the C stack, whatever the limit.
+        depth = 100000
+        self.assertRaises(chjson.DecodeError, chjson.decode, '[' * depth + ']' * depth)
+        self.assertRaises(chjson.DecodeError, chjson.decode, '[' * depth, max_depth=depth + 1)
+        obj = chjson.decode('[' * depth + ']' * depth, max_depth=depth)
+        for _ in range(depth - 1):
+            obj = obj[0]
+        self.assertEqual([], obj)
+
+    def testDecodeLongComments(self):
+        # Comments longer than a scan block, with the characters that might
+        # end them at every offset, in 1-, 2- and 4-byte input.
+        filler = 'abcdefghijklmnopqrstuvwxyz /* // * / 0123456789' * 2
+        for wide in ('', '\u20ac', '\U0001f600'):
+            for i in range(len(filler) + 1):
+                text = wide + filler[:i] + '* ' + filler[i:]
+                self.assertEqual([1, 2], chjson.decode('[1, /* %s */ 2]' % (text,)))
+                self.assertEqual([1, 2], chjson.decode('[1, // %s\n 2]' % (text,)))
+                self.assertEqual([1, 2], chjson.decode('[1, // %s\r 2]' % (text,)))
+            self.assertRaises(chjson.DecodeError, chjson.decode, '[1, /* %s' % (filler,))
+            self.assertRaises(chjson.DecodeError, chjson.decode, '[1 // %s]' % (filler,))
+
+    def testDecodeCommentErrorLinenoAndOffset(self):
+        # Lines are counted inside comments just as outside them: a CR/LF
+        # pair counts once, but not when a comment separates the two.
+        for doc, message in (
+            ('[1, /* one\r\ntwo\n\nfour */ x]',
+                'cannot parse JSON description as token: "x" (lineno 4, offset 9)'),
+            ('[1, /*' + ' long comment ' * 10 + '\n*/ x]',
+                'cannot parse JSON description as token: "x" (lineno 2, offset 4)'),
+            ('[1,\r// a\r\n x]',
+                'cannot parse JSON description as token: "x" (lineno 3, offset 3)'),
+            ('[1,\r/* a\nb */ x]',
+                'cannot parse JSON description as token: "x" (lineno 3, offset 6)'),
+            ('[1, /* a\rb\n */ x]',
+                'cannot parse JSON description as token: "x" (lineno 3, offset 5)'),
+        ):
+            try:
+                chjson.decode(doc)
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                self.assertEqual(message, str(err))
+
+    def testDecodeBuffers(self):
+        # Anything with a contiguous buffer is read as UTF-8, without a copy,
+        # and without reading past its end (which needn't be NUL).
+        doc = '{"a": [1, 2.5, "\u00e9"], "b": null}'.encode('utf-8')
+        want = {"a": [1, 2.5, "\u00e9"], "b": None}
+        self.assertEqual(want, chjson.decode(bytearray(doc)))
+        self.assertEqual(want, chjson.decode(memoryview(doc)))
+        for tail in (b'', b'123', b'.5', b'e5', b'"', b'/x', b'\n'):
+            for src in (b'12', b'1.5', b'1e5', b'"x"', b'true', b'[1, 2]', b'// c'):
+                view = memoryview(src + tail)[:len(src)]
+                try:
+                    expected = chjson.decode(src)
+                except chjson.DecodeError:
+                    self.assertRaises(chjson.DecodeError, chjson.decode, view)
+                else:
+                    self.assertEqual(expected, chjson.decode(view))
+        self.assertRaises(chjson.DecodeError, chjson.decode, memoryview(b'"abc"')[:4])
+        self.assertRaises(chjson.DecodeError, chjson.decode, memoryview(b'[1]')[:0])
+        self.assertRaises(TypeError, chjson.decode, 123)
+
+    def testDecodeNul(self):
+        # A NUL in the input isn't its end, but an invalid character, where it is.
+        for doc, position, offset in (('{"a":\x001}', 5, 5), ('"a\x00b"', 2, 2), ('[1,\x002]', 3, 3),
+                                      ('[1]\x00', 3, 3), ('[1] \x00 [2]', 4, 4), ('{"a"\x00: 1}', 4, 4),
+                                      ('\x00', 0, 0), ('[1,\n "\u00e9\x00"]', 7, 4), ('/* \x00 */ 1', 3, 3)):
+            message = "invalid character '\\0' at position %d (lineno %d, offset %d)" % (
+                position, doc.count('\n', 0, position) + 1, offset)
+            for source in (doc, doc.encode('utf-8'), bytearray(doc.encode('utf-8'))):
+                try:
+                    chjson.decode(source, strict=(doc[0] != '/'))
+                    self.fail("expected a DecodeError")
+                except chjson.DecodeError as err:
+                    self.assertEqual(message, str(err))
+        self.assertRaisesRegex(chjson.DecodeError, "invalid character", list, chjson.iterdecode(b'1 2 \x00 3'))
+
+    def testDecodeMmap(self):
+        doc = b'[' + b'1, ' * (mmap.PAGESIZE // 3) + b'2]'
+        with tempfile.TemporaryFile() as fileobj:
+            fileobj.write(doc)
+            fileobj.flush()
+            mapped = mmap.mmap(fileobj.fileno(), 0, access=mmap.ACCESS_READ)
+            try:
+                self.assertEqual([1] * (mmap.PAGESIZE // 3) + [2], chjson.decode(mapped))
+            finally:
+                mapped.close()
+
+    def testDecodeFile(self):
+        doc = '// settings\n{"caf\u00e9": [1, 2.5, true], "n": null,}\n'
+        tmpdir = tempfile.mkdtemp()
+        try:
+            path = os.path.join(tmpdir, 'settings.json')
+            with open(path, 'wb') as fileobj:
+                fileobj.write(doc.encode('utf-8'))
+            self.assertEqual({"caf\u00e9": [1, 2.5, True], "n": None}, chjson.decode_file(path))
+            self.assertEqual(chjson.decode(doc), chjson.decode_file(path.encode()))
+            try:
+                chjson.decode_file(path, strict=True)
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                self.assertTrue(str(err).startswith(path + ': '))
+                self.assertTrue(str(err).endswith('(lineno 1, offset 0)'))
+            # A file that's been cut short, even mid-character, fails cleanly.
+            encoded = doc.encode('utf-8')
+            for length in (len(encoded) - 2, encoded.index(b'\xc3') + 1, 5):
+                os.truncate(path, length)
+                try:
+                    chjson.decode_file(path)
+                    self.fail("expected a DecodeError")
+                except chjson.DecodeError as err:
+                    self.assertTrue(str(err).startswith(path + ': '))
+            empty = os.path.join(tmpdir, 'empty.json')
+            open(empty, 'wb').close()
+            self.assertRaises(chjson.DecodeError, chjson.decode_file, empty)
+            missing = os.path.join(tmpdir, 'missing.json')
+            try:
+                chjson.decode_file(missing)
+                self.fail("expected an OSError")
+            except OSError as err:
+                self.assertEqual(missing, err.filename)
+            self.assertRaises(ValueError, chjson.decode_file, path, max_depth=0)
+        finally:
+            for name in os.listdir(tmpdir):
+                os.remove(os.path.join(tmpdir, name))
+            os.rmdir(tmpdir)
+
+    def testDecodeLargeDocuments(self):
+        # Big enough to be tokenized without the GIL, from several threads
+        # at once, as str, UTF-8 bytes, and (mutable) bytearray.
+        rows = [{"id": i, "name": "r\u00e9cord %d" % (i,), "tags": ["a", "b"], "score": i / 7.0,
+                 "big": 10 ** 25 + i, "ok": None} for i in range(3000)]
+        doc = json.dumps(rows)
+        self.assertTrue(len(doc) > 64 * 1024)
+        inputs = [doc, doc.encode('utf-8'), bytearray(doc.encode('utf-8'))]
+        results = []
+        def decode_all():
+            for data in inputs:
+                results.append(chjson.decode(data) == rows)
+        threads = [threading.Thread(target=decode_all) for _ in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual([True] * 12, results)
+        try:
+            chjson.decode(doc[:-1] + ',\n]', strict=True)
+            self.fail("expected a DecodeError")
+        except chjson.DecodeError as err:
+            self.assertEqual(
+                'expecting array item at position %d (lineno 2, offset 1)' % (len(doc) + 1,), str(err))
+
+    def testDecodeIntegerTooLongForPython(self):
+        if not hasattr(sys, 'set_int_max_str_digits'):
+            return
+        saved = sys.get_int_max_str_digits()
+        sys.set_int_max_str_digits(1000)
+        try:
+            doc = '[1,\n  %s]' % ('7' * 1001,)
+            try:
+                chjson.decode(doc)
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                self.assertEqual('invalid number starting at position 6 (lineno 2, offset 3)', str(err))
+            self.assertEqual([1, int('7' * 1000)], chjson.decode('[1, %s]' % ('7' * 1000,)))
+        finally:
+            sys.set_int_max_str_digits(saved)
+
+    def testDecodeMany(self):
+        docs = ['[1, "a"]', b'{"caf\xc3\xa9": true}', bytearray(b'[null]'), '[1,', '{"k": 2.5,}']
+        expected = [[1, "a"], {"caf\u00e9": True}, [None], None, {"k": 2.5}]
+        for threads in (0, 1, 3):
+            results = chjson.decode_many(docs, threads=threads)
+            self.assertEqual(len(docs), len(results))
+            self.assertTrue(isinstance(results[3], chjson.DecodeError))
+            self.assertEqual('unterminated array starting at position 0 (lineno 1, offset 3)', str(results[3]))
+            results[3] = None
+            self.assertEqual(expected, results)
+        results = chjson.decode_many(iter(docs), threads=2, strict=True)
+        self.assertTrue(isinstance(results[4], chjson.DecodeError))
+        many = [('{"id": %d, "tags": ["x", "y"]}' % (i,)).encode() for i in range(1000)]
+        self.assertEqual([chjson.decode(doc) for doc in many], chjson.decode_many(many, threads=4))
+        # Asking for more threads than there are CPUs (or documents) is fine.
+        self.assertEqual([chjson.decode(doc) for doc in many], chjson.decode_many(many, threads=100000))
+        self.assertEqual([[1], [2]], chjson.decode_many(['[1]', b'[2]'], threads=2 ** 31 - 1))
+        self.assertEqual([], chjson.decode_many([]))
+        self.assertRaises(TypeError, chjson.decode_many, ['1', 2], threads=2)
+        self.assertRaises(ValueError, chjson.decode_many, ['1'], threads=-1)
+
+    def testRawDecode(self):
+        self.assertEqual(({"a": [1, 2]}, 14), chjson.raw_decode(' {"a": [1, 2]} trailing'))
+        self.assertEqual((12, 4), chjson.raw_decode(b'  12 34'))
+        # The offset is in characters of a str, and bytes of a buffer.
+        self.assertEqual(("café", 6), chjson.raw_decode('"café" x'))
+        self.assertEqual(("café", 7), chjson.raw_decode(b'"caf\xc3\xa9" x'))
+        self.assertRaises(chjson.DecodeError, chjson.raw_decode, ' // nothing')
+        self.assertRaises(chjson.DecodeError, chjson.raw_decode, '[1,] x', strict=True)
+
+    def testIterDecode(self):
+        self.assertEqual(
+            [{"a": 1}, [2], 3, "x", None],
+            list(chjson.iterdecode(b'{"a": 1}\n[2]\n3 // three\n"x"null'))
+        )
+        self.assertEqual([], list(chjson.iterdecode(' \n ')))
+        rows = [{"id": i, "tags": ["a"] * (i % 5)} for i in range(5000)]
+        lines = '\n'.join(json.dumps(row) for row in rows)
+        self.assertEqual(rows, list(chjson.iterdecode(lines)))
+        self.assertEqual([rows, rows], list(chjson.iterdecode(json.dumps(rows) * 2)))
+        # The values before an error come out first, and then it's done.
+        values = chjson.iterdecode('1\n2\n[3,')
+        self.assertEqual(1, next(values))
+        self.assertEqual(2, next(values))
+        try:
+            next(values)
+            self.fail("expected a DecodeError")
+        except chjson.DecodeError as err:
+            self.assertEqual('unterminated array starting at position 4 (lineno 3, offset 4)', str(err))
+        self.assertEqual([], list(values))
+
+    def testDecodeLines(self):
+        rows = [{"id": i, "name": "récord %d" % (i,), "tags": ["a"] * (i % 5)} for i in range(10000)]
+        doc = ('\n'.join(json.dumps(row) for row in rows) + '\n').encode('utf-8')
+        for threads in (1, 4, 100000):
+            self.assertEqual(rows, chjson.decode_lines(doc, threads=threads))
+            self.assertEqual(rows, list(chjson.iterdecode_lines(doc, threads=threads)))
+        self.assertEqual(rows, chjson.decode_lines(bytearray(doc)))
+        # Blank lines are skipped, and CR/LF line endings are fine.
+        self.assertEqual([1, [2], "x"], chjson.decode_lines(b'1\n\n  \n[2]\r\n"x"'))
+        self.assertEqual([], chjson.decode_lines(b''))
+        # Errors are positioned as iterdecode() positions them, after CR/LFs, too.
+        for crlf in (b'{"a":1}\r\n[1,,2]\r\n', b'{"a":1}\n[1,,2]\n', b'\r\n\r\n[1,,2]'):
+            try:
+                list(chjson.iterdecode(crlf))
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                message = str(err)
+            for decode_lines in (chjson.decode_lines, lambda lines: list(chjson.iterdecode_lines(lines))):
+                try:
+                    decode_lines(crlf)
+                    self.fail("expected a DecodeError")
+                except chjson.DecodeError as err:
+                    self.assertEqual(message, str(err))
+        # Even more than a window's worth of them.
+        blanks = b'\n' * (1024 * 1024 + 10)
+        self.assertEqual([1] * 2048 + [2], chjson.decode_lines(b'1\n' * 2048 + blanks + b'2\n'))
+        self.assertEqual([1, 2], list(chjson.iterdecode_lines(blanks + b'1\n2\n')))
+        self.assertEqual([], chjson.decode_lines(blanks))
+        lines = doc.split(b'\n')
+        lines[8000] = b'{"a": [1, 2}'
+        with tempfile.NamedTemporaryFile(suffix='.jsonl', delete=False) as jsonl:
+            jsonl.write(b'\n'.join(lines))
+        try:
+            self.assertEqual(rows[:5], list(itertools.islice(chjson.iterdecode_lines(jsonl.name), 5)))
+            try:
+                chjson.decode_lines(jsonl.name, threads=4)
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                position = len(b'\n'.join(lines[:8000]).decode('utf-8')) + 12
+                self.assertEqual(
+                    "%s: expecting ',' or ']' at position %d (lineno 8001, offset 12)"
+                    % (jsonl.name, position),
+                    str(err)
+                )
+        finally:
+            os.unlink(jsonl.name)
+        self.assertRaises(OSError, chjson.decode_lines, jsonl.name)
+
+    def testIterPath(self):
+        rows = [{"id": i, "name": "r\u00e9cord %d" % (i,), "tags": ["a"] * (i % 3)} for i in range(2000)]
+        doc = json.dumps({"meta": {"count": len(rows)}, "items": rows}, indent=2).encode('utf-8')
+        self.assertEqual(rows, list(chjson.iter_path(doc, "$.items[*]")))
+        self.assertEqual(rows, list(chjson.iter_path(io.BytesIO(doc), "$.items[*]")))
+        self.assertEqual([r["name"] for r in rows], list(chjson.iter_path(doc.decode('utf-8'), "$.items[*].name")))
+        self.assertEqual([2000], list(chjson.iter_path(io.BytesIO(doc), "$['meta'].count")))
+        self.assertEqual([["a", "a"]], list(chjson.iter_path(doc, "$.items[5].tags")))
+        self.assertEqual([1, [2]], list(chjson.iter_path("{'a': 1, /* x */ 'b': [2],}", "$.*")))
+        self.assertEqual([], list(chjson.iter_path(doc, "$.nope[*]")))
+        self.assertRaises(ValueError, chjson.iter_path, doc, "items")
+        # Values yielded before an error (in an earlier chunk) still come out.
+        values = chjson.iter_path(io.StringIO('{"items": [%s,]}' % (', '.join(['1'] * 10000),)),
+                                  "$.items[*]", strict=True)
+        self.assertEqual([1] * 100, list(itertools.islice(values, 100)))
+        self.assertRaises(chjson.DecodeError, list, values)
+        self.assertRaises(chjson.DecodeError, list, chjson.iter_path(b'{"items": []} x', "$.items"))
+
+    def testParseEvents(self):
+        self.assertEqual(
+            [('start_object', None), ('key', 'a'), ('start_array', None), ('value', 1),
+             ('value', 'caf\u00e9'), ('value', None), ('end_array', None), ('key', 'b'),
+             ('start_object', None), ('end_object', None), ('end_object', None)],
+            chjson.parse_events(b'{"a": [1, "caf\xc3\xa9", null,], /* c */ \'b\': {}}')
+        )
+        self.assertEqual([('value', 2.5)], chjson.parse_events(' 2.5 '))
+        # A handler's methods are called, and events it has no method for are skipped.
+        class Handler(object):
+            def __init__(self):
+                self.calls = []
+            def start_array(self):
+                self.calls.append('[')
+            def key(self, key):
+                self.calls.append(key)
+            def value(self, value):
+                self.calls.append(value)
+        handler = Handler()
+        self.assertEqual(None, chjson.parse_events('{"x": [true, {"y": 1e400}]}', handler))
+        self.assertEqual(['x', '[', True, 'y', float('inf')], handler.calls)
+        rows = [{"id": i, "name": "r%d" % (i,), "tags": ["a", "b"]} for i in range(5000)]
+        handler = Handler()
+        chjson.parse_events(json.dumps(rows), handler)
+        self.assertEqual(1 + 5000 * 8, len(handler.calls))
+        self.assertEqual(['id', 4999, 'name', 'r4999', 'tags', '[', 'a', 'b'], handler.calls[-8:])
+        try:
+            chjson.parse_events('[1, 2,]', strict=True)
+            self.fail("expected a DecodeError")
+        except chjson.DecodeError as err:
+            self.assertEqual('expecting array item at position 6 (lineno 1, offset 6)', str(err))
+        self.assertRaises(chjson.DecodeError, chjson.parse_events, '[1] 2', handler)
+
+    def testValidate(self):
+        self.assertEqual(None, chjson.validate('{"a": [1, 2.5e400, 123456789012345678901234567890]}'))
+        self.assertEqual(None, chjson.validate(b"{'a': .5, /* c */ 'b': [1,],} // c"))
+        self.assertRaises(chjson.DecodeError, chjson.validate, b"{'a': 1}", strict=True)
+        rows = [{"id": i, "name": "r\u00e9cord %d" % (i,), "tags": ["a", "b"]} for i in range(5000)]
+        doc = json.dumps(rows).encode('utf-8')
+        self.assertEqual(None, chjson.validate(doc))
+        self.assertEqual(None, chjson.validate(bytearray(doc)))
+        # The errors are decode()'s.
+        for bad in (doc[:-1], doc[:-1] + b', {"id": }]', b'', b'[1] 2', b'"\xff"'):
+            try:
+                chjson.decode(bad)
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                message = str(err)
+            try:
+                chjson.validate(bad)
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                self.assertEqual(message, str(err))
+        # And an integer too long for int() fails, as decode() can't convert it.
+        if hasattr(sys, 'get_int_max_str_digits'):
+            limit = sys.get_int_max_str_digits()
+            try:
+                for max_digits in (640, 4300, 0):
+                    sys.set_int_max_str_digits(max_digits)
+                    for digits in (639, 641, 4299, 4301):
+                        for doc in ('[' + '1' * digits + ']', '{"a": [1,\n  -' + '9' * digits + ']}'):
+                            try:
+                                chjson.decode(doc)
+                                message = None
+                            except chjson.DecodeError as err:
+                                message = str(err)
+                            try:
+                                self.assertEqual(message, chjson.validate(doc))
+                            except chjson.DecodeError as err:
+                                self.assertEqual(message, str(err))
+            finally:
+                sys.set_int_max_str_digits(limit)
+
+    def testInputChanged(self):
+        # A read-only view of a bytearray can still change underneath the
+        # decoder, between tokenizing and building, which is caught.
+        for old, new in ((b'\xc3\xa9\xc3\xa9', b'abcd'), (b'abcd', b'\xe8\xa8\x98d'),
+                         (b'ab\\n', b'\xff\xff\\n'), (b'\xe8\xa8\x98!', b'\xf0\x9f\x98\x80')):
+            document = bytearray(b'["x", "' + old + b'"]')
+            values = chjson.iter_path(memoryview(document).toreadonly(), "$[*]")
+            self.assertEqual("x", next(values))
+            document[7:7 + len(old)] = new
+            self.assertRaises(chjson.DecodeError, next, values)
+
+    def testDecoderFeed(self):
+        decoder = chjson.Decoder()
+        self.assertEqual([1, 2], decoder.feed(b'1 2 [3'))
+        self.assertEqual([[3]], decoder.feed(b'] {"caf\xc3'))
+        self.assertEqual([{"caf\u00e9": 4}], decoder.feed(b'\xa9": 4}\n  5'))
+        self.assertEqual([5], decoder.close())
+        self.assertRaises(ValueError, decoder.feed, b'6')
+        # Fed a byte at a time, a document comes out the same as decode()'s.
+        rows = [{"id": i, "name": "r\u00e9cord %d" % (i,), "tags": ["a", "b"], "score": i / 7.0,
+                 "big": 10 ** 25 + i} for i in range(300)]
+        doc = json.dumps(rows, indent=2).encode('utf-8')
+        decoder = chjson.Decoder()
+        values = []
+        for i in range(len(doc)):
+            values += decoder.feed(doc[i:i + 1])
+        values += decoder.close()
+        self.assertEqual([rows], values)
+
+    def testDecoderErrors(self):
+        decoder = chjson.Decoder(strict=True)
+        self.assertEqual([[1]], decoder.feed('[1]\n'))
+        self.assertEqual([[2]], decoder.feed('[2]\n'))
+        try:
+            decoder.feed('[3,]')
+            self.fail("expected a DecodeError")
+        except chjson.DecodeError as err:
+            self.assertEqual('expecting array item at position 11 (lineno 3, offset 4)', str(err))
+        # The values before an error are returned first.
+        decoder = chjson.Decoder()
+        self.assertEqual([[1]], decoder.feed('[1] x'))
+        self.assertRaises(chjson.DecodeError, decoder.feed, '2')
+        decoder = chjson.Decoder()
+        self.assertEqual([], decoder.feed('{"a": [1, 2'))
+        try:
+            decoder.close()
+            self.fail("expected a DecodeError")
+        except chjson.DecodeError as err:
+            self.assertEqual('unterminated array starting at position 6 (lineno 1, offset 11)', str(err))
+        # However the input's split into chunks, the error quotes what iterdecode()'s does.
+        for doc in (b'[true, fals,] ', b'[1, nul, 2, 3, 4, 5, 6, 7, 8, 9, 10]', '{"caf\u00e9": NaX, "b": "\u00e9\u00e9"}'):
+            try:
+                list(chjson.iterdecode(doc))
+                self.fail("expected a DecodeError")
+            except chjson.DecodeError as err:
+                message = str(err)
+            for i in range(len(doc) + 1):
+                decoder = chjson.Decoder()
+                try:
+                    decoder.feed(doc[:i])
+                    decoder.feed(doc[i:])
+                    decoder.close()
+                    self.fail("expected a DecodeError")
+                except chjson.DecodeError as err:
+                    self.assertEqual(message, str(err))
+
 def main():
     unittest.main()
 